@@ -8,6 +8,7 @@
 
 #include "src/pika_hub_server.h"
 #include "src/pika_hub_conf.h"
+#include "src/pika_hub_binlog_compression.h"
 #include "src/pika_hub_command.h"
 
 PikaHubServer* g_pika_hub_server;
@@ -121,6 +122,59 @@ int main(int argc, char** argv) {
   options.info_log_level = static_cast<rocksutil::InfoLogLevel>(
       g_pika_hub_conf->info_log_level());
   options.pika_servers = g_pika_hub_conf->pika_servers();
+  options.binlog_options.group_max_records =
+    g_pika_hub_conf->binlog_group_max_records();
+  options.binlog_options.group_max_bytes =
+    g_pika_hub_conf->binlog_group_max_bytes();
+  options.binlog_options.group_linger_us =
+    g_pika_hub_conf->binlog_group_linger_us();
+  options.binlog_options.pipeline_write =
+    g_pika_hub_conf->binlog_pipeline_write();
+  options.binlog_options.file_size =
+    g_pika_hub_conf->binlog_file_size();
+  options.binlog_options.sync_mode =
+    g_pika_hub_conf->binlog_sync_mode();
+  options.binlog_options.sync_interval_ms =
+    g_pika_hub_conf->binlog_sync_interval_ms();
+  options.binlog_options.sync_bytes =
+    g_pika_hub_conf->binlog_sync_bytes();
+  options.binlog_options.compression =
+    g_pika_hub_conf->binlog_compression();
+  options.binlog_options.compression_min_bytes =
+    g_pika_hub_conf->binlog_compression_min_bytes();
+  options.binlog_options.entry_version =
+    g_pika_hub_conf->binlog_entry_version();
+  options.binlog_options.expire_files =
+    g_pika_hub_conf->binlog_expire_files();
+  options.binlog_options.expire_seconds =
+    g_pika_hub_conf->binlog_expire_seconds();
+  options.binlog_options.max_total_size =
+    g_pika_hub_conf->binlog_max_total_size();
+  options.binlog_options.archive_path =
+    g_pika_hub_conf->binlog_archive_path();
+  options.binlog_options.tail_cache_size =
+    g_pika_hub_conf->binlog_tail_cache_size();
+  options.binlog_options.dispatch_queue_size =
+    g_pika_hub_conf->binlog_dispatch_queue_size();
+  options.binlog_options.conflict_huge_page =
+    g_pika_hub_conf->conflict_table_huge_page();
+  options.binlog_options.conflict_fingerprint =
+    g_pika_hub_conf->conflict_table_fingerprint();
+  options.binlog_options.conflict_max_memory =
+    g_pika_hub_conf->conflict_table_max_memory();
+  options.binlog_options.conflict_spill_path =
+    g_pika_hub_conf->conflict_table_spill_path();
+  options.binlog_options.conflict_single_writer_bits =
+    g_pika_hub_conf->conflict_table_single_writer_bits();
+  options.binlog_options.conflict_snapshot_path =
+    g_pika_hub_conf->conflict_table_snapshot_path();
+  options.binlog_options.conflict_snapshot_interval =
+    g_pika_hub_conf->conflict_table_snapshot_interval();
+  if (!BinlogCompressionSupported(options.binlog_options.compression)) {
+    fprintf(stderr, "binlog-compression %s is not supported by this build\n",
+        BinlogCompressionName(options.binlog_options.compression));
+    exit(-1);
+  }
 
   SignalSetup();
   InitCmdInfoTable();
@@ -12,6 +12,7 @@
 #include "src/pika_hub_admin.h"
 #include "src/pika_hub_server.h"
 #include "src/pika_hub_conf.h"
+#include "src/pika_hub_binlog_compression.h"
 #include "src/pika_hub_version.h"
 #include "src/build_version.h"
 
@@ -59,8 +60,55 @@ void InfoCmd::Do() {
     g_pika_hub_server->last_qps() << "\r\n";
   tmp_stream << "total_commands_processed:" <<
     g_pika_hub_server->query_num() << "\r\n";
-  tmp_stream << "lru_cache_record_num:" <<
-    g_pika_hub_server->binlog_manager()->GetLruMemUsage() << "\r\n";
+  ConflictTable* conflict_table =
+    g_pika_hub_server->binlog_manager()->conflict_table();
+  tmp_stream << "lru_cache_record_num:" << conflict_table->Size() << "\r\n";
+  tmp_stream << "conflict_table_memory:" <<
+    conflict_table->MemoryUsage() << "\r\n";
+  tmp_stream << "conflict_table_max_memory:" <<
+    conflict_table->max_memory() << "\r\n";
+  tmp_stream << "conflict_table_evictions:" <<
+    conflict_table->evictions() << "\r\n";
+  tmp_stream << "conflict_table_collected:" <<
+    conflict_table->collected() << "\r\n";
+  tmp_stream << "conflict_table_spill:" <<
+    (conflict_table->spill_enabled() ? "yes" : "no") << "\r\n";
+  tmp_stream << "conflict_table_spilled:" <<
+    conflict_table->spilled() << "\r\n";
+  tmp_stream << "conflict_table_spill_hits:" <<
+    conflict_table->spill_hits() << "\r\n";
+  tmp_stream << "conflict_table_spill_errors:" <<
+    conflict_table->spill_errors() << "\r\n";
+  tmp_stream << "conflict_table_over_budget:" <<
+    conflict_table->over_budget() << "\r\n";
+  tmp_stream << "conflict_table_single_writer_cells:" <<
+    conflict_table->single_writer_cells() << "\r\n";
+  tmp_stream << "conflict_table_contended_cells:" <<
+    conflict_table->contended_cells() << "\r\n";
+  tmp_stream << "conflict_table_single_writer_update_hit_rate:" <<
+    conflict_table->SingleWriterUpdateHitRate() << "\r\n";
+  tmp_stream << "conflict_table_single_writer_lookup_hit_rate:" <<
+    conflict_table->SingleWriterLookupHitRate() << "\r\n";
+  tmp_stream << "conflict_table_prepared_hit_rate:" <<
+    conflict_table->PreparedHitRate() << "\r\n";
+  SnapshotStats snapshot_stats;
+  g_pika_hub_server->binlog_manager()->GetSnapshotStats(&snapshot_stats);
+  tmp_stream << "conflict_table_snapshots:" <<
+    snapshot_stats.snapshots << "\r\n";
+  tmp_stream << "conflict_table_snapshot_errors:" <<
+    snapshot_stats.errors << "\r\n";
+  tmp_stream << "conflict_table_last_snapshot_us:" <<
+    snapshot_stats.last_snapshot_us << "\r\n";
+  tmp_stream << "conflict_table_last_snapshot_bytes:" <<
+    snapshot_stats.last_snapshot_bytes << "\r\n";
+  tmp_stream << "conflict_table_snapshot_replay_from:" <<
+    snapshot_stats.replay_from << "\r\n";
+  tmp_stream << "conflict_table_recover_us:" <<
+    snapshot_stats.recover_us << "\r\n";
+  tmp_stream << "conflict_table_fingerprint:" <<
+    (conflict_table->fingerprint() ? "yes" : "no") << "\r\n";
+  tmp_stream << "conflict_table_expected_collisions:" <<
+    conflict_table->ExpectedCollisions() << "\r\n";
 
   if (g_pika_hub_server->is_primary()) {
     tmp_stream << "# Info for [Primary]\r\n";
@@ -76,6 +124,90 @@ void InfoCmd::Do() {
     g_pika_hub_server->GetBinlogWriterOffset(&number, &offset);
     tmp_stream << "binlog_writer_offset:" << number <<
       ":" << offset << "\r\n";
+    GroupCommitStats group_stats;
+    g_pika_hub_server->GetGroupCommitStats(&group_stats);
+    tmp_stream << "binlog_group_commits:" << group_stats.groups << "\r\n";
+    tmp_stream << "binlog_group_records:" << group_stats.records << "\r\n";
+    tmp_stream << "binlog_group_bytes:" << group_stats.bytes << "\r\n";
+    tmp_stream << "binlog_group_avg_records:" <<
+      (group_stats.groups == 0 ? 0 :
+       group_stats.records / group_stats.groups) << "\r\n";
+    tmp_stream << "binlog_group_max_records:" <<
+      group_stats.max_group_records << "\r\n";
+    tmp_stream << "binlog_group_cut_num:" << group_stats.cut_groups << "\r\n";
+    tmp_stream << "binlog_group_leader_wait_us:" <<
+      group_stats.linger_us << "\r\n";
+    tmp_stream << "binlog_group_follower_waits:" <<
+      "spin=" << group_stats.spin_waits <<
+      ",yield=" << group_stats.yield_waits <<
+      ",block=" << group_stats.block_waits << "\r\n";
+    tmp_stream << "binlog_compression:" <<
+      BinlogCompressionName(g_pika_hub_conf->binlog_compression()) <<
+      "\r\n";
+    tmp_stream << "binlog_compressed_groups:" <<
+      group_stats.compressed_groups << "\r\n";
+    tmp_stream << "binlog_written_bytes:" <<
+      group_stats.written_bytes << "\r\n";
+    tmp_stream << "binlog_compression_ratio:" <<
+      (group_stats.written_bytes == 0 ? 1.0 :
+       static_cast<double>(group_stats.bytes) / group_stats.written_bytes) <<
+      "\r\n";
+    RollStats roll_stats;
+    g_pika_hub_server->GetRollStats(&roll_stats);
+    tmp_stream << "binlog_file_rolls:" << roll_stats.rolls << "\r\n";
+    tmp_stream << "binlog_file_preallocated_rolls:" <<
+      roll_stats.preallocated_rolls << "\r\n";
+    tmp_stream << "binlog_file_max_roll_us:" <<
+      roll_stats.max_roll_us << "\r\n";
+    SyncStats sync_stats;
+    g_pika_hub_server->GetSyncStats(&sync_stats);
+    tmp_stream << "binlog_sync_mode:" <<
+      (sync_stats.mode == kBinlogSyncGroup ? "group" :
+       sync_stats.mode == kBinlogSyncPeriodic ? "periodic" : "none") <<
+      "\r\n";
+    tmp_stream << "binlog_syncs:" << sync_stats.syncs << "\r\n";
+    tmp_stream << "binlog_sync_avg_us:" <<
+      (sync_stats.syncs == 0 ? 0 :
+       sync_stats.sync_us / sync_stats.syncs) << "\r\n";
+    tmp_stream << "binlog_sync_max_us:" << sync_stats.max_sync_us << "\r\n";
+    tmp_stream << "binlog_range_syncs:" << sync_stats.range_syncs << "\r\n";
+    tmp_stream << "binlog_range_sync_bytes:" <<
+      sync_stats.range_sync_bytes << "\r\n";
+    tmp_stream << "binlog_sync_errors:" << sync_stats.errors << "\r\n";
+    PurgeStats purge_stats;
+    g_pika_hub_server->binlog_manager()->GetPurgeStats(&purge_stats);
+    tmp_stream << "binlog_files:" << purge_stats.files << "\r\n";
+    tmp_stream << "binlog_total_bytes:" << purge_stats.total_bytes << "\r\n";
+    tmp_stream << "binlog_oldest_number:" <<
+      purge_stats.first_number << "\r\n";
+    tmp_stream << "binlog_purge_limit:" << purge_stats.purge_limit << "\r\n";
+    tmp_stream << "binlog_purged_files:" <<
+      purge_stats.purged_files << "\r\n";
+    tmp_stream << "binlog_purged_bytes:" <<
+      purge_stats.purged_bytes << "\r\n";
+    TailCacheStats tail_stats;
+    g_pika_hub_server->binlog_manager()->GetTailCacheStats(&tail_stats);
+    tmp_stream << "binlog_tail_cache_records:" <<
+      tail_stats.records << "\r\n";
+    tmp_stream << "binlog_tail_cache_bytes:" << tail_stats.bytes << "\r\n";
+    tmp_stream << "binlog_tail_cache_hits:" << tail_stats.hits << "\r\n";
+    tmp_stream << "binlog_tail_cache_misses:" << tail_stats.misses << "\r\n";
+    BinlogDispatcher* dispatcher =
+      g_pika_hub_server->binlog_manager()->dispatcher();
+    if (dispatcher != nullptr) {
+      DispatchStats dispatch_stats;
+      dispatcher->GetDispatchStats(&dispatch_stats);
+      tmp_stream << "binlog_dispatch_batches:" <<
+        dispatch_stats.batches << "\r\n";
+      tmp_stream << "binlog_dispatch_commands:" <<
+        dispatch_stats.commands << "\r\n";
+      tmp_stream << "binlog_dispatch_conflicted:" <<
+        dispatch_stats.conflicted << "\r\n";
+      tmp_stream << "binlog_dispatch_subscribers:" <<
+        dispatch_stats.subscribers << "\r\n";
+      tmp_stream << "binlog_dispatch_overflows:" <<
+        dispatch_stats.overflows << "\r\n";
+    }
     char buf[64];
     std::time_t tt = std::chrono::system_clock::to_time_t(
           g_pika_hub_server->last_success_save_offset_time());
@@ -219,3 +351,39 @@ void RemoveCmd::Do() {
   }
   return;
 }
+
+void PurgelogsCmd::DoInitial(const PikaCmdArgsType &argv,
+    const CmdInfo* const ptr_info) {
+  if (!ptr_info->CheckArg(argv.size()) || argv.size() > 2) {
+    res_.SetRes(CmdRes::kWrongNum, kCmdNamePurgelogs);
+    return;
+  }
+  limit_ = UINT64_MAX;
+  if (argv.size() == 2) {
+    int64_t limit = 0;
+    if (!slash::string2l(argv[1].data(), argv[1].size(), &limit) ||
+        limit < 0) {
+      res_.SetRes(CmdRes::kInvalidInt);
+      return;
+    }
+    limit_ = limit;
+  }
+}
+
+void PurgelogsCmd::Do() {
+  if (g_pika_hub_server->is_primary()) {
+    uint64_t purged = 0;
+    rocksutil::Status s = g_pika_hub_server->PurgeBinlogs(limit_, &purged);
+    if (s.IsBusy()) {
+      res_.SetRes(CmdRes::kPurgeExist);
+    } else if (!s.ok()) {
+      res_.SetRes(CmdRes::kErrOther, s.ToString());
+    } else {
+      res_.AppendInteger(static_cast<int>(purged));
+    }
+  } else {
+    res_.SetRes(CmdRes::kErrOther,
+        "This operation is only allowed for the primary node");
+  }
+  return;
+}
@@ -90,4 +90,15 @@ class RemoveCmd : public Cmd {
   std::string addr_;
 };
 
+class PurgelogsCmd : public Cmd {
+ public:
+  PurgelogsCmd() : limit_(UINT64_MAX) {}
+  virtual void Do() override;
+
+ private:
+  virtual void DoInitial(const PikaCmdArgsType &argvs,
+      const CmdInfo* const ptr_info) override;
+  uint64_t limit_;
+};
+
 #endif  // SRC_PIKA_HUB_ADMIN_H_
@@ -0,0 +1,177 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/pika_hub_binlog_compression.h"
+
+#include <snappy.h>
+#ifdef LZ4
+#include <lz4.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
+#include "rocksutil/coding.h"
+
+// a frame must save at least 1/8 of the raw size
+static bool GoodCompressionRatio(size_t compressed_size, size_t raw_size) {
+  return compressed_size < raw_size - (raw_size / 8u);
+}
+
+bool BinlogCompressionSupported(BinlogCompressionType type) {
+  switch (type) {
+    case kBinlogNoCompression:
+    case kBinlogSnappyCompression:
+      return true;
+    case kBinlogLZ4Compression:
+#ifdef LZ4
+      return true;
+#else
+      return false;
+#endif
+    case kBinlogZSTDCompression:
+#ifdef ZSTD
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* BinlogCompressionName(BinlogCompressionType type) {
+  switch (type) {
+    case kBinlogNoCompression:
+      return "none";
+    case kBinlogSnappyCompression:
+      return "snappy";
+    case kBinlogLZ4Compression:
+      return "lz4";
+    case kBinlogZSTDCompression:
+      return "zstd";
+    default:
+      return "unknown";
+  }
+}
+
+bool BinlogCompress(BinlogCompressionType type,
+    const rocksutil::Slice& record, std::string* output) {
+  uint8_t flags = kBinlogFrameFlag;
+  rocksutil::Slice raw(record);
+  if (IsBinlogFrame(record)) {
+    flags = static_cast<uint8_t>(record[0]) & ~kBinlogCompressionMask;
+    raw.remove_prefix(1);
+  }
+  output->clear();
+  output->push_back(static_cast<char>(flags | type));
+  rocksutil::PutVarint32(output, static_cast<uint32_t>(raw.size()));
+  size_t header_size = output->size();
+
+  size_t compressed_size = 0;
+  switch (type) {
+    case kBinlogSnappyCompression: {
+      output->resize(header_size + snappy::MaxCompressedLength(raw.size()));
+      snappy::RawCompress(raw.data(), raw.size(),
+          &(*output)[header_size], &compressed_size);
+      break;
+    }
+#ifdef LZ4
+    case kBinlogLZ4Compression: {
+      int bound = LZ4_compressBound(static_cast<int>(raw.size()));
+      output->resize(header_size + bound);
+      int ret = LZ4_compress_default(raw.data(), &(*output)[header_size],
+          static_cast<int>(raw.size()), bound);
+      if (ret <= 0) {
+        return false;
+      }
+      compressed_size = ret;
+      break;
+    }
+#endif
+#ifdef ZSTD
+    case kBinlogZSTDCompression: {
+      size_t bound = ZSTD_compressBound(raw.size());
+      output->resize(header_size + bound);
+      size_t ret = ZSTD_compress(&(*output)[header_size], bound,
+          raw.data(), raw.size(), 1);
+      if (ZSTD_isError(ret)) {
+        return false;
+      }
+      compressed_size = ret;
+      break;
+    }
+#endif
+    default:
+      return false;
+  }
+
+  if (!GoodCompressionRatio(header_size + compressed_size, record.size())) {
+    return false;
+  }
+  output->resize(header_size + compressed_size);
+  return true;
+}
+
+rocksutil::Status BinlogUncompress(const rocksutil::Slice& record,
+    std::string* output, rocksutil::Slice* result, bool* v2) {
+  if (!IsBinlogFrame(record)) {
+    *result = record;
+    *v2 = false;
+    return rocksutil::Status::OK();
+  }
+
+  uint8_t flags = static_cast<uint8_t>(record[0]);
+  uint8_t type = flags & kBinlogCompressionMask;
+  *v2 = (flags & kBinlogV2Flag) != 0;
+  rocksutil::Slice input(record.data() + 1, record.size() - 1);
+  if (type == kBinlogNoCompression) {
+    *result = input;
+    return rocksutil::Status::OK();
+  }
+  uint32_t raw_size = 0;
+  if (!rocksutil::GetVarint32(&input, &raw_size)) {
+    return rocksutil::Status::Corruption("bad binlog frame header");
+  }
+
+  output->resize(raw_size);
+  switch (type) {
+    case kBinlogSnappyCompression: {
+      size_t size = 0;
+      if (!snappy::GetUncompressedLength(input.data(), input.size(), &size) ||
+          size != raw_size ||
+          !snappy::RawUncompress(input.data(), input.size(), &(*output)[0])) {
+        return rocksutil::Status::Corruption("bad snappy binlog frame");
+      }
+      break;
+    }
+#ifdef LZ4
+    case kBinlogLZ4Compression: {
+      int ret = LZ4_decompress_safe(input.data(), &(*output)[0],
+          static_cast<int>(input.size()), static_cast<int>(raw_size));
+      if (ret < 0 || static_cast<uint32_t>(ret) != raw_size) {
+        return rocksutil::Status::Corruption("bad lz4 binlog frame");
+      }
+      break;
+    }
+#endif
+#ifdef ZSTD
+    case kBinlogZSTDCompression: {
+      size_t ret = ZSTD_decompress(&(*output)[0], raw_size,
+          input.data(), input.size());
+      if (ZSTD_isError(ret) || ret != raw_size) {
+        return rocksutil::Status::Corruption("bad zstd binlog frame");
+      }
+      break;
+    }
+#endif
+    default:
+      return rocksutil::Status::NotSupported("binlog compression type",
+          BinlogCompressionName(static_cast<BinlogCompressionType>(type)));
+  }
+
+  *result = rocksutil::Slice(*output);
+  return rocksutil::Status::OK();
+}
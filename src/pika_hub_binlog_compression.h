@@ -0,0 +1,38 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_BINLOG_COMPRESSION_H_
+#define SRC_PIKA_HUB_BINLOG_COMPRESSION_H_
+
+#include <string>
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_binlog_format.h"
+#include "rocksutil/slice.h"
+#include "rocksutil/status.h"
+
+// see pika_hub_binlog_format.h for the frame layout
+
+extern bool BinlogCompressionSupported(BinlogCompressionType type);
+extern const char* BinlogCompressionName(BinlogCompressionType type);
+
+/*
+ *  Compress raw into a frame stored in output, raw is either plain v1
+ *  entries or an uncompressed frame, whose format flags are kept.
+ *  Return false if type is not supported or compression saves too
+ *  little to be worth it, the caller should write raw as is then
+ */
+extern bool BinlogCompress(BinlogCompressionType type,
+    const rocksutil::Slice& raw, std::string* output);
+
+/*
+ *  Decode record to the plain entries, output is only used as the
+ *  buffer if record is compressed, *result points into record itself
+ *  otherwise. *v2 tells the entry format of *result
+ */
+extern rocksutil::Status BinlogUncompress(const rocksutil::Slice& record,
+    std::string* output, rocksutil::Slice* result, bool* v2);
+
+#endif  // SRC_PIKA_HUB_BINLOG_COMPRESSION_H_
@@ -0,0 +1,158 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/pika_hub_binlog_decoder.h"
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_binlog_format.h"
+#include "rocksutil/coding.h"
+
+/*
+ *  Entry decoders of each format, DecodeEntries is instantiated per
+ *  format & output, so the per-entry loop has no format branch, see
+ *  pika_hub_binlog_format.h for the layouts
+ */
+struct BinlogEntryDecoderV1 {
+  static bool DecodeHeader(const char** p, const char* limit,
+      BinlogFieldsView* base) {
+    return true;
+  }
+  static bool DecodeEntry(const char** p, const char* limit,
+      const BinlogFieldsView& base, BinlogFieldsView* entry) {
+    const char* ptr = *p;
+    if (limit - ptr < kBinlogEntryHeaderSize) {
+      return false;
+    }
+    entry->op = static_cast<uint8_t>(*ptr);
+    entry->server_id = rocksutil::DecodeFixed32(ptr + 1);
+    entry->exec_time = rocksutil::DecodeFixed32(ptr + 5);
+    entry->filenum = rocksutil::DecodeFixed32(ptr + 9);
+    uint32_t key_size = rocksutil::DecodeFixed32(ptr + 13);
+    ptr += 17;
+    if (static_cast<uint64_t>(limit - ptr) < key_size + 4ULL) {
+      return false;
+    }
+    entry->key = rocksutil::Slice(ptr, key_size);
+    ptr += key_size;
+    uint32_t value_size = rocksutil::DecodeFixed32(ptr);
+    ptr += 4;
+    if (static_cast<uint64_t>(limit - ptr) < value_size) {
+      return false;
+    }
+    entry->value = rocksutil::Slice(ptr, value_size);
+    *p = ptr + value_size;
+    return true;
+  }
+};
+
+struct BinlogEntryDecoderV2 {
+  static bool DecodeHeader(const char** p, const char* limit,
+      BinlogFieldsView* base) {
+    uint32_t server_id = 0;
+    uint32_t exec_time = 0;
+    const char* ptr = rocksutil::GetVarint32Ptr(*p, limit, &server_id);
+    if (ptr == nullptr) {
+      return false;
+    }
+    ptr = rocksutil::GetVarint32Ptr(ptr, limit, &exec_time);
+    if (ptr == nullptr) {
+      return false;
+    }
+    base->server_id = ZigZagDecode32(server_id);
+    base->exec_time = ZigZagDecode32(exec_time);
+    *p = ptr;
+    return true;
+  }
+  static bool DecodeEntry(const char** p, const char* limit,
+      const BinlogFieldsView& base, BinlogFieldsView* entry) {
+    const char* ptr = *p;
+    uint32_t server_id = 0;
+    uint32_t exec_time = 0;
+    uint32_t filenum = 0;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    if (ptr >= limit) {
+      return false;
+    }
+    entry->op = static_cast<uint8_t>(*ptr++);
+    if ((ptr = rocksutil::GetVarint32Ptr(ptr, limit, &server_id)) == nullptr ||
+        (ptr = rocksutil::GetVarint32Ptr(ptr, limit, &exec_time)) == nullptr ||
+        (ptr = rocksutil::GetVarint32Ptr(ptr, limit, &filenum)) == nullptr ||
+        (ptr = rocksutil::GetVarint32Ptr(ptr, limit, &key_size)) == nullptr ||
+        static_cast<uint64_t>(limit - ptr) < key_size) {
+      return false;
+    }
+    entry->key = rocksutil::Slice(ptr, key_size);
+    ptr += key_size;
+    if ((ptr = rocksutil::GetVarint32Ptr(ptr, limit, &value_size)) == nullptr ||
+        static_cast<uint64_t>(limit - ptr) < value_size) {
+      return false;
+    }
+    entry->value = rocksutil::Slice(ptr, value_size);
+    // deltas wrap around like the encoder's
+    entry->server_id = static_cast<int32_t>(
+        static_cast<uint32_t>(base.server_id) +
+        static_cast<uint32_t>(ZigZagDecode32(server_id)));
+    entry->exec_time = static_cast<int32_t>(
+        static_cast<uint32_t>(base.exec_time) +
+        static_cast<uint32_t>(ZigZagDecode32(exec_time)));
+    entry->filenum = ZigZagDecode32(filenum);
+    *p = ptr + value_size;
+    return true;
+  }
+};
+
+static inline void AppendEntry(const char* base,
+    const BinlogFieldsView& entry, std::vector<BinlogFieldsView>* result) {
+  result->push_back(entry);
+}
+
+static inline void AppendEntry(const char* base,
+    const BinlogFieldsView& entry, BinlogColumns* result) {
+  result->Reserve();
+  size_t i = result->count++;
+  result->ops[i] = entry.op;
+  result->server_ids[i] = entry.server_id;
+  result->exec_times[i] = entry.exec_time;
+  result->filenums[i] = entry.filenum;
+  result->key_offsets[i] = static_cast<uint32_t>(entry.key.data() - base);
+  result->key_sizes[i] = static_cast<uint32_t>(entry.key.size());
+  result->value_offsets[i] = static_cast<uint32_t>(entry.value.data() - base);
+  result->value_sizes[i] = static_cast<uint32_t>(entry.value.size());
+}
+
+template <typename Decoder, typename Output>
+static bool DecodeEntries(const rocksutil::Slice& content, Output* result) {
+  const char* p = content.data();
+  const char* limit = content.data() + content.size();
+  BinlogFieldsView base = {0, 0, 0, 0, rocksutil::Slice(),
+    rocksutil::Slice()};
+  if (!Decoder::DecodeHeader(&p, limit, &base)) {
+    return false;
+  }
+  BinlogFieldsView entry = base;
+  while (p < limit) {
+    if (!Decoder::DecodeEntry(&p, limit, base, &entry)) {
+      return false;
+    }
+    AppendEntry(content.data(), entry, result);
+  }
+  return true;
+}
+
+bool DecodeBinlogEntries(const rocksutil::Slice& content, bool v2,
+    std::vector<BinlogFieldsView>* result) {
+  result->clear();
+  return v2 ? DecodeEntries<BinlogEntryDecoderV2>(content, result) :
+    DecodeEntries<BinlogEntryDecoderV1>(content, result);
+}
+
+bool DecodeBinlogColumns(const rocksutil::Slice& content, bool v2,
+    BinlogColumns* result) {
+  result->Clear();
+  result->base = content.data();
+  return v2 ? DecodeEntries<BinlogEntryDecoderV2>(content, result) :
+    DecodeEntries<BinlogEntryDecoderV1>(content, result);
+}
@@ -0,0 +1,89 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_BINLOG_DECODER_H_
+#define SRC_PIKA_HUB_BINLOG_DECODER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "rocksutil/slice.h"
+
+/*
+ *  An entry of a binlog record, key & value point into the buffers of
+ *  the BinlogReader, valid until its next read
+ */
+struct BinlogFieldsView {
+  uint8_t op;
+  int32_t server_id;
+  int32_t exec_time;
+  int32_t filenum;
+  rocksutil::Slice key;
+  rocksutil::Slice value;
+};
+
+/*
+ *  The entries of a binlog record column by column: every fixed size
+ *  field packed in an array of its own, so a filter over one of them
+ *  is a tight loop over contiguous memory, and key & value as offsets
+ *  from base, the decoded content. Valid as long as the content is.
+ *  Only the first size() elements of the arrays are entries, they are
+ *  never shrunk, so a record usually decodes without any allocation
+ */
+struct BinlogColumns {
+  const char* base = nullptr;
+  size_t count = 0;
+  std::vector<uint8_t> ops;
+  std::vector<int32_t> server_ids;
+  std::vector<int32_t> exec_times;
+  std::vector<int32_t> filenums;
+  std::vector<uint32_t> key_offsets;
+  std::vector<uint32_t> key_sizes;
+  std::vector<uint32_t> value_offsets;
+  std::vector<uint32_t> value_sizes;
+
+  size_t size() const {
+    return count;
+  }
+  rocksutil::Slice Key(size_t i) const {
+    return rocksutil::Slice(base + key_offsets[i], key_sizes[i]);
+  }
+  rocksutil::Slice Value(size_t i) const {
+    return rocksutil::Slice(base + value_offsets[i], value_sizes[i]);
+  }
+  void Clear() {
+    base = nullptr;
+    count = 0;
+  }
+  // make room for one more entry
+  void Reserve() {
+    if (count == ops.size()) {
+      Resize(count < 16 ? 16 : count * 2);
+    }
+  }
+  void Resize(size_t n) {
+    ops.resize(n);
+    server_ids.resize(n);
+    exec_times.resize(n);
+    filenums.resize(n);
+    key_offsets.resize(n);
+    key_sizes.resize(n);
+    value_offsets.resize(n);
+    value_sizes.resize(n);
+  }
+};
+
+/*
+ *  Decode the plain entries of a record, as BinlogUncompress leaves
+ *  them, v2 tells their format. result is cleared first, return false
+ *  if an entry is malformed, the entries before it are kept
+ */
+extern bool DecodeBinlogEntries(const rocksutil::Slice& content, bool v2,
+    std::vector<BinlogFieldsView>* result);
+extern bool DecodeBinlogColumns(const rocksutil::Slice& content, bool v2,
+    BinlogColumns* result);
+
+#endif  // SRC_PIKA_HUB_BINLOG_DECODER_H_
@@ -0,0 +1,340 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/pika_hub_binlog_dispatcher.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "src/pika_hub_binlog_manager.h"
+
+/*
+ *  Serialize argv to the redis protocol at the end of rep, straight from
+ *  the views, the key & value are copied once
+ */
+static void AppendRedisCommand(std::string* rep,
+    const rocksutil::Slice* argv, int argc) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "*%d\r\n", argc);
+  rep->append(buf, len);
+  for (int i = 0; i < argc; i++) {
+    len = snprintf(buf, sizeof(buf), "$%zu\r\n", argv[i].size());
+    rep->append(buf, len);
+    rep->append(argv[i].data(), argv[i].size());
+    rep->append("\r\n", 2);
+  }
+}
+
+/*
+ *  The largest filenum of every server_id in columns. The entries of a
+ *  record come from one server_id mostly, check that with a loop over
+ *  the packed server_ids, then take the max over the packed filenums
+ */
+static void MaxFilenums(const BinlogColumns& columns,
+    std::vector<std::pair<int32_t, int32_t> >* filenums) {
+  const size_t n = columns.size();
+  if (n == 0) {
+    return;
+  }
+  const int32_t* server_ids = columns.server_ids.data();
+  const int32_t* nums = columns.filenums.data();
+  int32_t diff = 0;
+  for (size_t i = 1; i < n; i++) {
+    diff |= server_ids[i] ^ server_ids[0];
+  }
+  if (diff == 0) {
+    int32_t max_filenum = nums[0];
+    for (size_t i = 1; i < n; i++) {
+      max_filenum = std::max(max_filenum, nums[i]);
+    }
+    filenums->push_back(std::make_pair(server_ids[0], max_filenum));
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    bool found = false;
+    for (auto& filenum : *filenums) {
+      if (filenum.first == server_ids[i]) {
+        if (filenum.second < nums[i]) {
+          filenum.second = nums[i];
+        }
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      filenums->push_back(std::make_pair(server_ids[i], nums[i]));
+    }
+  }
+}
+
+void BuildDispatchedBatch(const BinlogColumns& columns,
+    ConflictTable* conflict_table, DispatchedBatch* batch) {
+  batch->Clear();
+  MaxFilenums(columns, &batch->filenums);
+
+  rocksutil::Slice argv[3];
+  for (size_t i = 0; i < columns.size(); i++) {
+    rocksutil::Slice key = columns.Key(i);
+    /*
+     *  Skip the record if a newer write of the key is in the binlog.
+     *  A missing entry was evicted or has a single writer, send the
+     *  record then: a newer write, if any, is sent after it,
+     *  dropping it may lose a write
+     */
+    int32_t _server_id = 0;
+    int32_t _exec_time = 0;
+    if (conflict_table->Lookup(key, &_server_id, &_exec_time) &&
+        columns.exec_times[i] < _exec_time) {
+      continue;
+    }
+
+    int argc = 0;
+    switch (columns.ops[i]) {
+      case kSetOPCode:
+        argv[argc++] = rocksutil::Slice("set", 3);
+        break;
+      case kDelOPCode:
+        argv[argc++] = rocksutil::Slice("del", 3);
+        break;
+      case kExpireatOPCode:
+        argv[argc++] = rocksutil::Slice("expireat", 8);
+        break;
+    }
+
+    argv[argc++] = key;
+
+    switch (columns.ops[i]) {
+      case kSetOPCode:
+        argv[argc++] = columns.Value(i);
+        break;
+      case kExpireatOPCode:
+        argv[argc++] = columns.Value(i);
+        break;
+    }
+
+    size_t begin = batch->rep.size();
+    AppendRedisCommand(&batch->rep, argv, argc);
+    batch->commands.push_back({columns.server_ids[i],
+        static_cast<uint32_t>(batch->rep.size() - begin)});
+  }
+}
+
+static size_t RoundUpToPowerOf2(size_t n) {
+  size_t capacity = 1;
+  while (capacity < n) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+DispatchQueue::DispatchQueue(size_t capacity)
+  : slots_(RoundUpToPowerOf2(capacity)),
+  mask_(slots_.size() - 1),
+  head_(0), tail_(0),
+  closed_(false), waiting_(false),
+  cv_(&mutex_) {
+}
+
+bool DispatchQueue::Push(const DispatchedBatchPtr& batch) {
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+    return false;
+  }
+  slots_[tail & mask_] = batch;
+  /*
+   *  seq_cst, pairs with Wait: either the consumer sees the batch, or
+   *  the producer sees it waiting
+   */
+  tail_.store(tail + 1);
+  if (waiting_.load()) {
+    rocksutil::MutexLock l(&mutex_);
+    cv_.Signal();
+  }
+  return true;
+}
+
+bool DispatchQueue::Pop(DispatchedBatchPtr* batch) {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  // do not pin the batch in the slot until it is overwritten
+  *batch = std::move(slots_[head & mask_]);
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void DispatchQueue::Wait(uint64_t timeout_us) {
+  uint64_t deadline_us = rocksutil::Env::Default()->NowMicros() + timeout_us;
+  rocksutil::MutexLock l(&mutex_);
+  waiting_.store(true);
+  if (head_.load(std::memory_order_relaxed) == tail_.load() && !closed()) {
+    cv_.TimedWait(deadline_us);
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+}
+
+void DispatchQueue::Close() {
+  rocksutil::MutexLock l(&mutex_);
+  closed_.store(true, std::memory_order_release);
+  cv_.Signal();
+}
+
+BinlogDispatcher::BinlogDispatcher(BinlogManager* manager,
+    BinlogReader* reader, size_t queue_size,
+    std::shared_ptr<rocksutil::Logger> info_log)
+  : manager_(manager), reader_(reader),
+  queue_size_(queue_size), info_log_(info_log),
+  number_(0), offset_(0),
+  batches_(0), commands_(0), conflicted_(0), overflows_(0) {
+  reader_->GetOffset(&number_, &offset_);
+}
+
+BinlogDispatcher::~BinlogDispatcher() {
+  set_should_stop();
+  {
+  // ThreadMain may be replacing reader_
+  rocksutil::MutexLock l(&mutex_);
+  reader_->StopRead();
+  }
+  StopThread();
+  delete reader_;
+
+  // the senders read the binlogs themselves from now on
+  rocksutil::MutexLock l(&mutex_);
+  for (auto& queue : queues_) {
+    queue->Close();
+  }
+  queues_.clear();
+}
+
+bool BinlogDispatcher::Subscribe(uint64_t number, uint64_t offset,
+    std::shared_ptr<DispatchQueue>* queue) {
+  rocksutil::MutexLock l(&mutex_);
+  if (number < number_ || (number == number_ && offset < offset_)) {
+    // the batches after number:offset are gone
+    return false;
+  }
+  /*
+   *  The sender may be ahead of the last batch published, it skips the
+   *  batches up to number:offset
+   */
+  queue->reset(new DispatchQueue(queue_size_));
+  queues_.push_back(*queue);
+  return true;
+}
+
+void BinlogDispatcher::Unsubscribe(
+    const std::shared_ptr<DispatchQueue>& queue) {
+  rocksutil::MutexLock l(&mutex_);
+  for (auto iter = queues_.begin(); iter != queues_.end(); iter++) {
+    if (*iter == queue) {
+      queues_.erase(iter);
+      break;
+    }
+  }
+  queue->Close();
+}
+
+void BinlogDispatcher::Publish(const DispatchedBatchPtr& batch) {
+  rocksutil::MutexLock l(&mutex_);
+  number_ = batch->number;
+  offset_ = batch->offset;
+  auto iter = queues_.begin();
+  while (iter != queues_.end()) {
+    if ((*iter)->Push(batch)) {
+      iter++;
+      continue;
+    }
+    // never wait for a slow sender, it would hold up all the others
+    (*iter)->Close();
+    iter = queues_.erase(iter);
+    overflows_++;
+  }
+}
+
+void BinlogDispatcher::GetDispatchStats(DispatchStats* stats) {
+  stats->batches = batches_;
+  stats->commands = commands_;
+  stats->conflicted = conflicted_;
+  stats->overflows = overflows_;
+  rocksutil::MutexLock l(&mutex_);
+  stats->subscribers = queues_.size();
+}
+
+BinlogReader* BinlogDispatcher::RestartFromTail(uint64_t number,
+    uint64_t offset) {
+  uint64_t tail_number = 0;
+  uint64_t tail_offset = 0;
+  {
+  rocksutil::MutexLock l(manager_->mutex());
+  manager_->GetWriterOffset(&tail_number, &tail_offset);
+  }
+  BinlogReader* reader = manager_->AddReader(tail_number, tail_offset);
+  if (reader == nullptr) {
+    return nullptr;
+  }
+  rocksutil::Error(info_log_, "BinlogDispatcher binlog %lu:%lu is purged, "
+      "dispatch from %lu:%lu", number, offset, tail_number, tail_offset);
+  // the subscribers missed the purged records, they read binlogs themselves
+  rocksutil::MutexLock l(&mutex_);
+  for (auto& queue : queues_) {
+    queue->Close();
+  }
+  queues_.clear();
+  reader->GetOffset(&number_, &offset_);
+  return reader;
+}
+
+void* BinlogDispatcher::ThreadMain() {
+  BinlogColumns columns;
+  while (!should_stop()) {
+    rocksutil::Status s = reader_->ReadRecord(&columns);
+    if (!s.ok()) {
+      if (should_stop()) {
+        break;
+      }
+      uint64_t number = 0;
+      uint64_t offset = 0;
+      reader_->GetOffset(&number, &offset);
+      rocksutil::Warn(info_log_, "BinlogDispatcher ReadRecord at %lu:%lu "
+          "failed: %s, RETRY", number, offset, s.ToString().c_str());
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      BinlogReader* reader = manager_->AddReader(number, offset);
+      if (reader == nullptr && manager_->BinlogPurged(number, offset)) {
+        reader = RestartFromTail(number, offset);
+      }
+      if (reader != nullptr) {
+        /*
+         *  Checked under mutex_, or the destructor may stop reader_ right
+         *  before it is replaced and wait for the new one forever
+         */
+        rocksutil::MutexLock l(&mutex_);
+        if (should_stop()) {
+          delete reader;
+          break;
+        }
+        delete reader_;
+        reader_ = reader;
+      }
+      continue;
+    }
+
+    // immutable once published, the senders share it
+    std::shared_ptr<DispatchedBatch> batch(new DispatchedBatch);
+    BuildDispatchedBatch(columns, manager_->conflict_table(), batch.get());
+    reader_->GetOffset(&batch->number, &batch->offset);
+    batches_++;
+    commands_ += batch->commands.size();
+    conflicted_ += columns.size() - batch->commands.size();
+    Publish(batch);
+  }
+  return nullptr;
+}
@@ -0,0 +1,155 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_BINLOG_DISPATCHER_H_
+#define SRC_PIKA_HUB_BINLOG_DISPATCHER_H_
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <atomic>
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_binlog_reader.h"
+#include "src/pika_hub_conflict_table.h"
+#include "pink/include/pink_thread.h"
+#include "rocksutil/mutexlock.h"
+#include "rocksutil/auto_roll_logger.h"
+#include "rocksutil/env.h"
+
+class BinlogManager;
+
+/*
+ *  One binlog record as the senders need it: the entries without a
+ *  newer write in the binlog, serialized to redis commands back to back
+ *  in rep, one Command each, and the largest filenum of every server_id,
+ *  conflicted entries included, for recover_offset. number:offset is the
+ *  position right after the record
+ */
+struct DispatchedBatch {
+  struct Command {
+    int32_t server_id;
+    uint32_t size;
+  };
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  std::vector<Command> commands;
+  std::string rep;
+  std::vector<std::pair<int32_t, int32_t> > filenums;
+
+  void Clear() {
+    commands.clear();
+    rep.clear();
+    filenums.clear();
+  }
+};
+
+typedef std::shared_ptr<const DispatchedBatch> DispatchedBatchPtr;
+
+/*
+ *  Decode once for every sender: conflict check the entries of a record
+ *  against conflict_table and serialize the rest, batch is cleared first
+ */
+extern void BuildDispatchedBatch(const BinlogColumns& columns,
+    ConflictTable* conflict_table, DispatchedBatch* batch);
+
+/*
+ *  Batches from the dispatcher to one sender, a single producer single
+ *  consumer ring, Push & Pop never lock. The consumer sleeps in Wait
+ *  once it is empty, the producer only takes the mutex to wake it up
+ */
+class DispatchQueue {
+ public:
+  explicit DispatchQueue(size_t capacity);
+
+  // Return false if the queue is full
+  bool Push(const DispatchedBatchPtr& batch);
+  // Return false if the queue is empty
+  bool Pop(DispatchedBatchPtr* batch);
+  // Wait until a batch is pushed, the queue is closed or timeout_us
+  void Wait(uint64_t timeout_us);
+  /*
+   *  No more batches are pushed, the batches queued can still be popped
+   */
+  void Close();
+  bool closed() const {
+    return closed_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<DispatchedBatchPtr> slots_;
+  const uint64_t mask_;
+  // next slot to pop, written by the consumer
+  std::atomic<uint64_t> head_;
+  // next slot to push, written by the producer
+  std::atomic<uint64_t> tail_;
+  std::atomic<bool> closed_;
+  std::atomic<bool> waiting_;
+  rocksutil::port::Mutex mutex_;
+  rocksutil::port::CondVar cv_;
+};
+
+struct DispatchStats {
+  uint64_t batches = 0;
+  uint64_t commands = 0;
+  // entries skipped for a newer write of the key
+  uint64_t conflicted = 0;
+  uint64_t subscribers = 0;
+  // queues closed for being full, their senders read the binlogs then
+  uint64_t overflows = 0;
+};
+
+/*
+ *  Reads the binlogs from the tail, builds a DispatchedBatch of every
+ *  record once and publishes it to the queue of every sender that has
+ *  caught up with it, so the read side costs the same with any number of
+ *  pikas. Senders behind it read the binlogs themselves until they
+ *  catch up. A sender too slow for its queue is dropped, and reads the
+ *  binlogs itself again from where the queue ends
+ */
+class BinlogDispatcher : public pink::Thread {
+ public:
+  BinlogDispatcher(BinlogManager* manager, BinlogReader* reader,
+      size_t queue_size, std::shared_ptr<rocksutil::Logger> info_log);
+  virtual ~BinlogDispatcher();
+
+  /*
+   *  Take the batches after number:offset from queue, if the dispatcher
+   *  has not gone past it yet. Return false otherwise
+   */
+  bool Subscribe(uint64_t number, uint64_t offset,
+      std::shared_ptr<DispatchQueue>* queue);
+  void Unsubscribe(const std::shared_ptr<DispatchQueue>& queue);
+  void GetDispatchStats(DispatchStats* stats);
+
+ private:
+  BinlogManager* manager_;
+  BinlogReader* reader_;
+  const size_t queue_size_;
+  std::shared_ptr<rocksutil::Logger> info_log_;
+
+  // protect queues_, the position of the last batch published & reader_
+  // replaced by ThreadMain
+  rocksutil::port::Mutex mutex_;
+  std::vector<std::shared_ptr<DispatchQueue> > queues_;
+  uint64_t number_;
+  uint64_t offset_;
+
+  std::atomic<uint64_t> batches_;
+  std::atomic<uint64_t> commands_;
+  std::atomic<uint64_t> conflicted_;
+  std::atomic<uint64_t> overflows_;
+
+  void Publish(const DispatchedBatchPtr& batch);
+  /*
+   *  Read from the writer offset once the binlog at number:offset is
+   *  purged, dropping every subscriber. Return nullptr on failure
+   */
+  BinlogReader* RestartFromTail(uint64_t number, uint64_t offset);
+  virtual void* ThreadMain() override;
+};
+
+#endif  // SRC_PIKA_HUB_BINLOG_DISPATCHER_H_
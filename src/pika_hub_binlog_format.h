@@ -0,0 +1,53 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_BINLOG_FORMAT_H_
+#define SRC_PIKA_HUB_BINLOG_FORMAT_H_
+
+#include <stdint.h>
+
+#include "rocksutil/slice.h"
+
+/*
+ *  A binlog record is either a plain concatenation of v1 entries, whose
+ *  first byte is an op code (1 ~ 3), or a frame starting with a flags
+ *  byte which has kBinlogFrameFlag set:
+ *
+ *  flags & kBinlogCompressionMask == kBinlogNoCompression:
+ *    | flags(1) | payload |
+ *  otherwise:
+ *    | flags(1) | raw_size(varint32) | compressed payload |
+ *
+ *  flags & kBinlogV2Flag tells the entry format of the payload.
+ *
+ *  v1 entry:
+ *    | op(1) | server_id(4) | exec_time(4) | filenum(4) |
+ *    | key_size(4) | key | value_size(4) | value |
+ *
+ *  v2 payload, a header followed by entries:
+ *    | base_server_id(zigzag varint32) | base_exec_time(zigzag varint32) |
+ *  v2 entry, server_id & exec_time are deltas from the base:
+ *    | op(1) | server_id(zigzag varint32) | exec_time(zigzag varint32) |
+ *    | filenum(zigzag varint32) | key_size(varint32) | key |
+ *    | value_size(varint32) | value |
+ */
+const uint8_t kBinlogFrameFlag = 0x80;
+const uint8_t kBinlogV2Flag = 0x08;
+const uint8_t kBinlogCompressionMask = 0x07;
+
+inline bool IsBinlogFrame(const rocksutil::Slice& record) {
+  return !record.empty() &&
+    (static_cast<uint8_t>(record[0]) & kBinlogFrameFlag) != 0;
+}
+
+inline uint32_t ZigZagEncode32(int32_t v) {
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+inline int32_t ZigZagDecode32(uint32_t v) {
+  return static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+#endif  // SRC_PIKA_HUB_BINLOG_FORMAT_H_
@@ -7,19 +7,52 @@
 #include "src/pika_hub_common.h"
 #include <string>
 #include <vector>
+#include <memory>
+#include <utility>
 #include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+
+#include "rocksutil/coding.h"
+#include "rocksutil/file_reader_writer.h"
+#include "rocksutil/log_reader.h"
+#include "rocksutil/log_writer.h"
 
 BinlogWriter* BinlogManager::AddWriter() {
   return CreateBinlogWriter(log_path_, number_,
-      env_, this);
+      env_, this, options_);
 }
 
 BinlogReader* BinlogManager::AddReader(uint64_t number,
     uint64_t offset) {
+  std::vector<uint64_t> numbers;
+  if (ListBinlogs(&numbers).ok() && !numbers.empty() &&
+      number < numbers.front()) {
+    if (number != 0 || offset != 0) {
+      // the records after number:offset are gone, skipping them loses data
+      rocksutil::Error(info_log_, "AddReader: binlog %lu is purged, the "
+          "oldest is %lu, a full sync is needed", number, numbers.front());
+      return nullptr;
+    }
+    // never read before, start from the oldest one
+    rocksutil::Info(info_log_, "AddReader: read from the oldest binlog %lu",
+        numbers.front());
+    number = numbers.front();
+  }
   return CreateBinlogReader(log_path_, env_,
       number, offset, this);
 }
 
+bool BinlogManager::BinlogPurged(uint64_t number, uint64_t offset) {
+  if (number == 0 && offset == 0) {
+    return false;
+  }
+  std::vector<uint64_t> numbers;
+  return ListBinlogs(&numbers).ok() && !numbers.empty() &&
+    number < numbers.front();
+}
+
 void BinlogManager::UpdateWriterOffset(uint64_t number,
     uint64_t offset) {
   number_ = number;
@@ -32,9 +65,637 @@ void BinlogManager::GetWriterOffset(uint64_t* number,
   *offset = offset_;
 }
 
+void BinlogManager::AddTailRecord(uint64_t number, uint64_t begin,
+    uint64_t end, const std::shared_ptr<const std::string>& record) {
+  rocksutil::MutexLock l(&tail_mutex_);
+  tail_records_.push_back({number, begin, end, record});
+  tail_bytes_ += record->size();
+  // keep the newest one even if it is larger than the cache
+  while (tail_bytes_ > static_cast<uint64_t>(options_.tail_cache_size) &&
+      tail_records_.size() > 1) {
+    tail_bytes_ -= tail_records_.front().record->size();
+    tail_records_.pop_front();
+  }
+}
+
+bool BinlogManager::GetTailRecord(uint64_t number, uint64_t offset,
+    uint64_t* next_number, uint64_t* next_offset,
+    std::shared_ptr<const std::string>* record) {
+  if (!tail_cache_enabled()) {
+    return false;
+  }
+  rocksutil::MutexLock l(&tail_mutex_);
+  auto iter = std::lower_bound(tail_records_.begin(), tail_records_.end(),
+      std::make_pair(number, offset),
+      [](const TailRecord& r, const std::pair<uint64_t, uint64_t>& pos) {
+        return r.number < pos.first ||
+          (r.number == pos.first && r.begin < pos.second);
+      });
+  if (iter == tail_records_.end()) {
+    // not written yet
+    return false;
+  }
+  if (iter->number != number || iter->begin != offset) {
+    /*
+     *  number:offset may be the end of a rolled file, the first record
+     *  of the next file follows it then
+     */
+    if (iter == tail_records_.begin() || iter->number != number + 1 ||
+        iter->begin != 0 || (iter - 1)->number != number ||
+        (iter - 1)->end != offset) {
+      tail_misses_++;
+      return false;
+    }
+  }
+  *next_number = iter->number;
+  *next_offset = iter->end;
+  *record = iter->record;
+  tail_hits_++;
+  return true;
+}
+
+void BinlogManager::ClearTailCache() {
+  rocksutil::MutexLock l(&tail_mutex_);
+  tail_records_.clear();
+  tail_bytes_ = 0;
+}
+
+void BinlogManager::GetTailCacheStats(TailCacheStats* stats) {
+  {
+  rocksutil::MutexLock l(&tail_mutex_);
+  stats->records = tail_records_.size();
+  stats->bytes = tail_bytes_;
+  }
+  stats->hits = tail_hits_;
+  stats->misses = tail_misses_;
+}
+
+int BinlogManager::StartDispatcher() {
+  if (options_.dispatch_queue_size <= 0) {
+    return 0;
+  }
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  {
+  rocksutil::MutexLock l(&mutex_);
+  GetWriterOffset(&number, &offset);
+  }
+  BinlogReader* reader = AddReader(number, offset);
+  if (reader == nullptr) {
+    return -1;
+  }
+  dispatcher_ = new BinlogDispatcher(this, reader,
+      options_.dispatch_queue_size, info_log_);
+  int ret = dispatcher_->StartThread();
+  if (ret != 0) {
+    delete dispatcher_;
+    dispatcher_ = nullptr;
+  }
+  return ret;
+}
+
+void BinlogManager::StopDispatcher() {
+  delete dispatcher_;
+  dispatcher_ = nullptr;
+}
+
+rocksutil::Status BinlogManager::ListBinlogs(std::vector<uint64_t>* numbers) {
+  numbers->clear();
+  std::vector<std::string> result;
+  rocksutil::Status s = env_->GetChildren(log_path_, &result);
+  if (!s.ok()) {
+    return s;
+  }
+  std::string prefix;
+  for (auto& file : result) {
+    prefix = file.substr(0, strlen(kBinlogPrefix));
+    if (prefix == kBinlogPrefix) {
+      numbers->push_back(std::strtoull(file.c_str() + strlen(kBinlogPrefix),
+            nullptr, 10));
+    }
+  }
+  std::sort(numbers->begin(), numbers->end());
+  return s;
+}
+
+rocksutil::Status BinlogManager::Recover() {
+  ClearTailCache();
+  std::vector<uint64_t> numbers;
+  rocksutil::Status s = ListBinlogs(&numbers);
+  if (!s.ok()) {
+    return s;
+  }
+  if (numbers.empty()) {
+    number_ = 0;
+    offset_ = 0;
+    return rocksutil::Status::NotFound("no binlog");
+  }
+
+  /*
+   *  Find the end of the last complete record in the newest file, the
+   *  rest was torn by a crash, readers must not see it
+   */
+  uint64_t last = numbers.back();
+  BinlogReader* reader = AddReader(last, 0);
+  if (reader == nullptr) {
+    return rocksutil::Status::IOError("open binlog failed",
+        std::to_string(last));
+  }
+  std::vector<BinlogFieldsView> fields;
+  uint64_t end = 0;
+  uint64_t record_end = 0;
+  while (reader->ReadRecordInFile(&fields, &record_end).ok()) {
+    end = record_end;
+  }
+  delete reader;
+
+  std::string filename = log_path_ + "/" + kBinlogPrefix +
+    std::to_string(last);
+  uint64_t file_size = 0;
+  s = env_->GetFileSize(filename, &file_size);
+  if (!s.ok()) {
+    return s;
+  }
+  if (end < file_size) {
+    rocksutil::Warn(info_log_, "Truncate torn binlog %lu from %lu to %lu",
+        last, file_size, end);
+    rocksutil::EnvOptions env_options;
+    std::unique_ptr<rocksutil::WritableFile> file;
+    s = env_->ReopenWritableFile(filename, &file, env_options);
+    if (s.ok()) {
+      s = file->Truncate(end);
+    }
+    if (s.ok()) {
+      s = file->Close();
+    }
+    if (!s.ok()) {
+      return s;
+    }
+  }
+
+  /*
+   *  Never append to an old file, log::Writer always starts from a
+   *  block boundary
+   */
+  number_ = last + 1;
+  offset_ = 0;
+  rocksutil::Info(info_log_, "Recover binlog %lu ~ %lu, write from %lu",
+      numbers.front(), last, number_);
+  return rocksutil::Status::OK();
+}
+
+/*
+ *  A snapshot is a log of records: a header of Fixed32 magic, Fixed64
+ *  replay_from, Fixed32 fingerprint and single writer bits, one record
+ *  per shard, see ConflictTable::EncodeShard, then Fixed32 magic, the
+ *  number of shards, which marks it complete, and Fixed32 1 if entries
+ *  were spilled. Spilled entries are not in the snapshot and the spill
+ *  tier is reset on open, so such a snapshot is not loaded
+ */
+rocksutil::Status BinlogManager::SnapshotConflictTable() {
+  rocksutil::MutexLock sl(&snapshot_mutex_);
+  if (options_.conflict_snapshot_path.empty()) {
+    return rocksutil::Status::NotSupported("no conflict snapshot path");
+  }
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  {
+  rocksutil::MutexLock l(&mutex_);
+  GetWriterOffset(&number, &offset);
+  }
+  /*
+   *  Nothing written since the last snapshot, or nothing written to the
+   *  current file yet, the table may be being recovered then
+   */
+  if (offset == 0 ||
+      (number == snapshot_number_ && offset == snapshot_offset_)) {
+    return rocksutil::Status::OK();
+  }
+  /*
+   *  The group being built when the snapshot starts may still take
+   *  entries of the file before the current one
+   */
+  uint64_t replay_from = number > 0 ? number - 1 : 0;
+  uint64_t start_us = env_->NowMicros();
+
+  std::string tmp_path = options_.conflict_snapshot_path + ".tmp";
+  rocksutil::EnvOptions env_options;
+  std::unique_ptr<rocksutil::WritableFile> writable_file;
+  rocksutil::Status s = rocksutil::NewWritableFile(env_, tmp_path,
+      &writable_file, env_options);
+  if (!s.ok()) {
+    snapshot_stats_.errors++;
+    return s;
+  }
+  std::unique_ptr<rocksutil::WritableFileWriter> file_writer(
+      new rocksutil::WritableFileWriter(std::move(writable_file),
+        env_options));
+  rocksutil::log::Writer writer(std::move(file_writer));
+
+  std::string rep;
+  rocksutil::PutFixed32(&rep, kConflictSnapshotMagic);
+  rocksutil::PutFixed64(&rep, replay_from);
+  rocksutil::PutFixed32(&rep, conflict_table_.fingerprint() ? 1 : 0);
+  rocksutil::PutFixed32(&rep, conflict_table_.single_writer_bits());
+  s = writer.AddRecord(rep);
+  for (int i = 0; s.ok() && i < kConflictTableShards; i++) {
+    rep.clear();
+    conflict_table_.EncodeShard(i, &rep);
+    s = writer.AddRecord(rep);
+  }
+  if (s.ok()) {
+    rep.clear();
+    rocksutil::PutFixed32(&rep, kConflictSnapshotMagic);
+    rocksutil::PutFixed32(&rep, kConflictTableShards);
+    // read after every shard is encoded, so no spill is missed
+    rocksutil::PutFixed32(&rep, conflict_table_.spilled() > 0 ? 1 : 0);
+    s = writer.AddRecord(rep);
+  }
+  if (s.ok()) {
+    s = writer.file()->Sync(false);
+  }
+  uint64_t bytes = writer.file()->GetFileSize();
+  if (s.ok()) {
+    s = writer.file()->Close();
+  }
+  if (s.ok()) {
+    s = env_->RenameFile(tmp_path, options_.conflict_snapshot_path);
+  }
+  if (!s.ok()) {
+    env_->DeleteFile(tmp_path);
+    snapshot_stats_.errors++;
+    return s;
+  }
+
+  snapshot_number_ = number;
+  snapshot_offset_ = offset;
+  snapshot_stats_.snapshots++;
+  snapshot_stats_.last_snapshot_us = env_->NowMicros() - start_us;
+  snapshot_stats_.last_snapshot_bytes = bytes;
+  snapshot_stats_.replay_from = replay_from;
+  rocksutil::Info(info_log_, "Snapshot conflict table: %lu bytes in %lu us, "
+      "replay from binlog %lu", bytes,
+      snapshot_stats_.last_snapshot_us.load(), replay_from);
+  return rocksutil::Status::OK();
+}
+
+rocksutil::Status BinlogManager::LoadConflictSnapshot(
+    const std::vector<uint64_t>& numbers, uint64_t* replay_from) {
+  if (options_.conflict_snapshot_path.empty()) {
+    return rocksutil::Status::NotFound("no conflict snapshot path");
+  }
+  rocksutil::EnvOptions env_options;
+  std::unique_ptr<rocksutil::SequentialFile> sequential_file;
+  rocksutil::Status s = rocksutil::NewSequentialFile(env_,
+      options_.conflict_snapshot_path, &sequential_file, env_options);
+  if (!s.ok()) {
+    return s;
+  }
+  std::unique_ptr<rocksutil::SequentialFileReader> sequential_reader(
+      new rocksutil::SequentialFileReader(std::move(sequential_file)));
+  rocksutil::log::Reader::LogReporter reporter;
+  reporter.status = &s;
+  rocksutil::log::Reader reader(std::move(sequential_reader), &reporter,
+      true, 0);
+
+  std::string scratch;
+  rocksutil::Slice record;
+  uint32_t magic = 0;
+  uint32_t fingerprint = 0;
+  uint32_t single_writer_bits = 0;
+  if (!reader.ReadRecord(&record, &scratch) ||
+      !rocksutil::GetFixed32(&record, &magic) ||
+      magic != kConflictSnapshotMagic ||
+      !rocksutil::GetFixed64(&record, replay_from) ||
+      !rocksutil::GetFixed32(&record, &fingerprint) ||
+      !rocksutil::GetFixed32(&record, &single_writer_bits)) {
+    return rocksutil::Status::Corruption("bad conflict snapshot header");
+  }
+  if ((fingerprint != 0) != conflict_table_.fingerprint() ||
+      static_cast<int32_t>(single_writer_bits) !=
+        conflict_table_.single_writer_bits()) {
+    return rocksutil::Status::InvalidArgument(
+        "conflict snapshot of another table layout");
+  }
+  if (numbers.empty() || *replay_from > numbers.back()) {
+    return rocksutil::Status::InvalidArgument(
+        "conflict snapshot newer than the binlogs");
+  }
+
+  // decode kConflictRecoverThreads shards at a time
+  int shards = 0;
+  bool ok = true;
+  std::vector<std::string> reps;
+  while (ok && shards < kConflictTableShards) {
+    reps.clear();
+    while (shards + static_cast<int>(reps.size()) < kConflictTableShards &&
+        reps.size() < static_cast<size_t>(kConflictRecoverThreads) &&
+        reader.ReadRecord(&record, &scratch)) {
+      reps.push_back(record.ToString());
+    }
+    if (reps.empty()) {
+      break;
+    }
+    std::vector<std::thread> threads;
+    std::vector<char> results(reps.size(), 0);
+    for (size_t i = 0; i < reps.size(); i++) {
+      threads.emplace_back([this, &reps, &results, i] {
+        results[i] = conflict_table_.DecodeShard(reps[i]) ? 1 : 0;
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    for (auto result : results) {
+      ok = ok && result;
+    }
+    shards += reps.size();
+  }
+  uint32_t count = 0;
+  uint32_t spilled = 0;
+  if (!ok || shards != kConflictTableShards ||
+      !reader.ReadRecord(&record, &scratch) ||
+      !rocksutil::GetFixed32(&record, &magic) ||
+      magic != kConflictSnapshotMagic ||
+      !rocksutil::GetFixed32(&record, &count) ||
+      count != static_cast<uint32_t>(kConflictTableShards) ||
+      !rocksutil::GetFixed32(&record, &spilled)) {
+    return rocksutil::Status::Corruption("incomplete conflict snapshot");
+  }
+  if (spilled != 0) {
+    return rocksutil::Status::Incomplete(
+        "conflict snapshot without the spilled entries");
+  }
+  return rocksutil::Status::OK();
+}
+
+namespace {
+
+// only what the conflict table needs, the values are not kept
+struct ReplayFile {
+  rocksutil::Status status;
+  std::vector<std::string> keys;
+  std::vector<int32_t> server_ids;
+  std::vector<int32_t> exec_times;
+  std::vector<uint64_t> hashes;
+};
+
+}  // namespace
+
+/*
+ *  Files are read and decoded kConflictRecoverThreads at a time in
+ *  parallel, then replayed by as many threads, each taking a share of
+ *  the shards, so the writes of a key are still replayed in order
+ */
+rocksutil::Status BinlogManager::ReplayBinlogs(
+    const std::vector<uint64_t>& numbers, int64_t* nums) {
+  const size_t window = kConflictRecoverThreads;
+  for (size_t begin = 0; begin < numbers.size(); begin += window) {
+    size_t end = std::min(begin + window, numbers.size());
+    std::vector<ReplayFile> files(end - begin);
+    std::vector<std::thread> threads;
+    for (size_t i = begin; i < end; i++) {
+      threads.emplace_back([this, &numbers, &files, begin, i] {
+        ReplayFile* file = &files[i - begin];
+        BinlogReader* reader = AddReader(numbers[i], 0);
+        if (reader == nullptr) {
+          file->status = rocksutil::Status::IOError("open binlog failed",
+              std::to_string(numbers[i]));
+          return;
+        }
+        std::vector<BinlogFieldsView> fields;
+        while ((file->status = reader->ReadRecordInFile(&fields,
+                nullptr)).ok()) {
+          for (auto& field : fields) {
+            file->hashes.push_back(ConflictTable::HashKey(field.key));
+            file->keys.push_back(field.key.ToString());
+            file->server_ids.push_back(field.server_id);
+            file->exec_times.push_back(field.exec_time);
+          }
+        }
+        delete reader;
+        if (file->status.IsNotFound()) {
+          file->status = rocksutil::Status::OK();
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    for (auto& file : files) {
+      if (!file.status.ok()) {
+        return file.status;
+      }
+    }
+
+    threads.clear();
+    for (int t = 0; t < kConflictRecoverThreads; t++) {
+      threads.emplace_back([this, &numbers, &files, begin, t] {
+        ConflictTable::Prepared prepared;
+        prepared.valid = false;
+        for (size_t i = 0; i < files.size(); i++) {
+          for (size_t j = 0; j < files[i].keys.size(); j++) {
+            uint64_t hash = files[i].hashes[j];
+            if (ConflictTable::ShardIndex(hash) % kConflictRecoverThreads
+                != t) {
+              continue;
+            }
+            prepared.hash = hash;
+            conflict_table_.Update(files[i].keys[j], files[i].server_ids[j],
+                files[i].exec_times[j], numbers[begin + i], &prepared);
+          }
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    for (auto& file : files) {
+      *nums += file.keys.size();
+    }
+  }
+  return rocksutil::Status::OK();
+}
+
+rocksutil::Status BinlogManager::RecoverConflictTable(int64_t* nums) {
+  *nums = 0;
+  uint64_t start_us = env_->NowMicros();
+  std::vector<uint64_t> numbers;
+  rocksutil::Status s = ListBinlogs(&numbers);
+  if (!s.ok()) {
+    return s;
+  }
+
+  uint64_t replay_from = 0;
+  s = LoadConflictSnapshot(numbers, &replay_from);
+  if (s.ok()) {
+    *nums = conflict_table_.Size();
+    rocksutil::Info(info_log_, "Load conflict snapshot, %ld entries, "
+        "replay from binlog %lu", *nums, replay_from);
+  } else {
+    rocksutil::Info(info_log_, "Load conflict snapshot failed: %s, replay "
+        "all binlogs", s.ToString().c_str());
+    // drop what a partly loaded snapshot left
+    conflict_table_.Reset();
+    replay_from = 0;
+  }
+  numbers.erase(numbers.begin(), std::lower_bound(numbers.begin(),
+        numbers.end(), replay_from));
+
+  s = ReplayBinlogs(numbers, nums);
+  snapshot_stats_.recover_us = env_->NowMicros() - start_us;
+  return s;
+}
+
+void BinlogManager::CollectConflictTable(uint64_t limit) {
+  {
+  rocksutil::MutexLock l(&mutex_);
+  // late writes of the last two files are still resolved by the writer
+  limit = std::min(limit, number_ > 0 ? number_ - 1 : 0);
+  }
+  conflict_table_.Collect(limit);
+}
+
+rocksutil::Status BinlogManager::RemoveBinlog(uint64_t number) {
+  std::string filename = kBinlogPrefix + std::to_string(number);
+  if (options_.archive_path.empty()) {
+    return env_->DeleteFile(log_path_ + "/" + filename);
+  }
+  rocksutil::Status s = env_->CreateDirIfMissing(options_.archive_path);
+  if (!s.ok()) {
+    return s;
+  }
+  return env_->RenameFile(log_path_ + "/" + filename,
+      options_.archive_path + "/" + filename);
+}
+
+rocksutil::Status BinlogManager::PurgeBinlogs(uint64_t limit,
+    uint64_t* purged) {
+  *purged = 0;
+  if (purging_.exchange(true)) {
+    return rocksutil::Status::Busy("binlog is being purged");
+  }
+  {
+  rocksutil::MutexLock l(&mutex_);
+  // never purge the file being written
+  limit = std::min(limit, number_);
+  }
+  purge_limit_ = limit;
+
+  std::vector<uint64_t> numbers;
+  rocksutil::Status s = ListBinlogs(&numbers);
+  std::vector<uint64_t> sizes(numbers.size(), 0);
+  uint64_t total_size = 0;
+  for (size_t i = 0; s.ok() && i < numbers.size(); i++) {
+    env_->GetFileSize(log_path_ + "/" + kBinlogPrefix +
+        std::to_string(numbers[i]), &sizes[i]);
+    total_size += sizes[i];
+  }
+
+  uint64_t now = env_->NowMicros() / 1000000;
+  for (size_t i = 0; s.ok() && i < numbers.size(); i++) {
+    if (numbers[i] >= limit) {
+      break;
+    }
+    uint64_t mtime = 0;
+    env_->GetFileModificationTime(log_path_ + "/" + kBinlogPrefix +
+        std::to_string(numbers[i]), &mtime);
+    bool expired =
+      (options_.expire_files > 0 &&
+       numbers.size() - i > static_cast<size_t>(options_.expire_files)) ||
+      (options_.expire_seconds > 0 &&
+       mtime + options_.expire_seconds < now) ||
+      (options_.max_total_size > 0 &&
+       total_size > static_cast<uint64_t>(options_.max_total_size));
+    if (!expired) {
+      break;
+    }
+    s = RemoveBinlog(numbers[i]);
+    if (!s.ok()) {
+      rocksutil::Warn(info_log_, "Purge binlog %lu failed: %s",
+          numbers[i], s.ToString().c_str());
+      break;
+    }
+    total_size -= sizes[i];
+    purged_bytes_ += sizes[i];
+    purged_files_++;
+    (*purged)++;
+  }
+  if (*purged > 0) {
+    rocksutil::Info(info_log_, "Purge %lu binlogs below %lu, %s", *purged,
+        limit, options_.archive_path.empty() ? "deleted" : "archived");
+  }
+  purging_ = false;
+  return s;
+}
+
+uint64_t BinlogManager::RetentionLimit() {
+  std::vector<uint64_t> numbers;
+  if (!ListBinlogs(&numbers).ok()) {
+    return 0;
+  }
+  std::vector<uint64_t> sizes(numbers.size(), 0);
+  uint64_t total_size = 0;
+  for (size_t i = 0; i < numbers.size(); i++) {
+    env_->GetFileSize(log_path_ + "/" + kBinlogPrefix +
+        std::to_string(numbers[i]), &sizes[i]);
+    total_size += sizes[i];
+  }
+
+  uint64_t now = env_->NowMicros() / 1000000;
+  uint64_t limit = 0;
+  // never the file being written, the last one
+  for (size_t i = 0; i + 1 < numbers.size(); i++) {
+    uint64_t mtime = 0;
+    env_->GetFileModificationTime(log_path_ + "/" + kBinlogPrefix +
+        std::to_string(numbers[i]), &mtime);
+    bool expired =
+      (options_.expire_seconds > 0 &&
+       mtime + options_.expire_seconds < now) ||
+      (options_.max_total_size > 0 &&
+       total_size > static_cast<uint64_t>(options_.max_total_size));
+    if (!expired) {
+      break;
+    }
+    total_size -= sizes[i];
+    limit = numbers[i] + 1;
+  }
+  return limit;
+}
+
+void BinlogManager::GetPurgeStats(PurgeStats* stats) {
+  std::vector<uint64_t> numbers;
+  ListBinlogs(&numbers);
+  stats->files = numbers.size();
+  stats->total_bytes = 0;
+  for (auto number : numbers) {
+    uint64_t size = 0;
+    env_->GetFileSize(log_path_ + "/" + kBinlogPrefix +
+        std::to_string(number), &size);
+    stats->total_bytes += size;
+  }
+  stats->first_number = numbers.empty() ? 0 : numbers.front();
+  stats->purge_limit = purge_limit_;
+  stats->purged_files = purged_files_;
+  stats->purged_bytes = purged_bytes_;
+}
+
 void BinlogManager::ResetOffsetAndBinlog() {
   number_ = 0;
   offset_ = 0;
+  ClearTailCache();
+  // its entries refer to the binlog numbers of the removed binlogs
+  conflict_table_.Reset();
+
+  {
+  // the snapshot refers to the binlogs removed below
+  rocksutil::MutexLock l(&snapshot_mutex_);
+  if (!options_.conflict_snapshot_path.empty()) {
+    env_->DeleteFile(options_.conflict_snapshot_path);
+  }
+  snapshot_number_ = 0;
+  snapshot_offset_ = 0;
+  }
 
   std::vector<std::string> result;
   rocksutil::Status s = env_->GetChildren(log_path_, &result);
@@ -42,14 +703,79 @@ void BinlogManager::ResetOffsetAndBinlog() {
   std::string prefix;
   for (auto& file : result) {
     prefix = file.substr(0, strlen(kBinlogPrefix));
-    if (prefix == kBinlogPrefix) {
+    if (prefix == kBinlogPrefix ||
+        file.compare(0, strlen(kBinlogPreallocPrefix),
+          kBinlogPreallocPrefix) == 0) {
       s = env_->DeleteFile(log_path_ + "/" + file);
     }
   }
 }
 
+void BinlogManager::GetSnapshotStats(SnapshotStats* stats) {
+  stats->snapshots = snapshot_stats_.snapshots;
+  stats->errors = snapshot_stats_.errors;
+  stats->last_snapshot_us = snapshot_stats_.last_snapshot_us;
+  stats->last_snapshot_bytes = snapshot_stats_.last_snapshot_bytes;
+  stats->replay_from = snapshot_stats_.replay_from;
+  stats->recover_us = snapshot_stats_.recover_us;
+}
+
+void BinlogManager::BackgroundSnapshot() {
+  const uint64_t interval_us =
+    static_cast<uint64_t>(options_.conflict_snapshot_interval) * 1000000;
+  uint64_t last_snapshot_us = env_->NowMicros();
+  while (true) {
+    {
+    rocksutil::MutexLock l(&snapshotter_mutex_);
+    while (!snapshotter_should_stop_ &&
+        env_->NowMicros() < last_snapshot_us + interval_us) {
+      snapshotter_cv_.TimedWait(last_snapshot_us + interval_us);
+    }
+    if (snapshotter_should_stop_) {
+      break;
+    }
+    }
+    rocksutil::Status s = SnapshotConflictTable();
+    if (!s.ok()) {
+      rocksutil::Warn(info_log_, "Snapshot conflict table failed: %s",
+          s.ToString().c_str());
+    }
+    last_snapshot_us = env_->NowMicros();
+  }
+}
+
+void* BinlogManager::Snapshotter::ThreadMain() {
+  manager_->BackgroundSnapshot();
+  return nullptr;
+}
+
+int BinlogManager::StartSnapshotter() {
+  snapshotter_ = new Snapshotter(this);
+  int ret = snapshotter_->StartThread();
+  if (ret != 0) {
+    delete snapshotter_;
+    snapshotter_ = nullptr;
+  }
+  return ret;
+}
+
+void BinlogManager::StopSnapshotter() {
+  if (snapshotter_ == nullptr) {
+    return;
+  }
+  {
+  rocksutil::MutexLock l(&snapshotter_mutex_);
+  snapshotter_should_stop_ = true;
+  snapshotter_cv_.SignalAll();
+  }
+  snapshotter_->StopThread();
+  delete snapshotter_;
+  snapshotter_ = nullptr;
+}
+
 BinlogManager* CreateBinlogManager(const std::string& log_path,
-    rocksutil::Env* env, std::shared_ptr<rocksutil::Logger> info_log) {
+    rocksutil::Env* env, std::shared_ptr<rocksutil::Logger> info_log,
+    const BinlogOptions& options) {
   std::vector<std::string> result;
   rocksutil::Status s = env->GetChildren(log_path, &result);
 
@@ -57,13 +783,40 @@ BinlogManager* CreateBinlogManager(const std::string& log_path,
     return nullptr;
   }
 
-  std::string prefix;
+  /*
+   *  Keep the binlogs, they are resumed or reset when becoming primary,
+   *  only the preallocated files are useless
+   */
   for (auto& file : result) {
-    prefix = file.substr(0, strlen(kBinlogPrefix));
-    if (prefix == kBinlogPrefix) {
+    if (file.compare(0, strlen(kBinlogPreallocPrefix),
+          kBinlogPreallocPrefix) == 0) {
       s = env->DeleteFile(log_path + "/" + file);
     }
   }
 
-  return new BinlogManager(log_path, env, info_log);
+  BinlogManager* manager = new BinlogManager(log_path, env, info_log,
+      options);
+  if (options.conflict_max_memory > 0 &&
+      manager->conflict_table()->max_memory() !=
+        static_cast<size_t>(options.conflict_max_memory)) {
+    rocksutil::Warn(info_log, "conflict_max_memory %ld is below the least "
+        "the conflict table takes, use %zu", options.conflict_max_memory,
+        manager->conflict_table()->max_memory());
+  }
+  if (!options.conflict_spill_path.empty()) {
+    rocksdb::Status rs = manager->conflict_table()->OpenSpill(
+        options.conflict_spill_path);
+    if (!rs.ok()) {
+      rocksutil::Warn(info_log, "Open conflict spill %s failed: %s, the "
+          "conflict table may grow over its max memory", options.conflict_spill_path.c_str(),
+          rs.ToString().c_str());
+    }
+  }
+  if (!options.conflict_snapshot_path.empty() &&
+      options.conflict_snapshot_interval > 0 &&
+      manager->StartSnapshotter() != 0) {
+    rocksutil::Warn(info_log, "Start conflict snapshotter failed, the "
+        "conflict table is recovered from all binlogs");
+  }
+  return manager;
 }
@@ -8,28 +8,82 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <atomic>
 
 #include "src/pika_hub_binlog_writer.h"
 #include "src/pika_hub_binlog_reader.h"
-#include "rocksutil/cache.h"
+#include "src/pika_hub_binlog_dispatcher.h"
+#include "src/pika_hub_conflict_table.h"
+#include "src/pika_hub_common.h"
+#include "pink/include/pink_thread.h"
+
+struct PurgeStats {
+  uint64_t files = 0;
+  uint64_t total_bytes = 0;
+  uint64_t first_number = 0;
+  // files below it may be purged
+  uint64_t purge_limit = 0;
+  uint64_t purged_files = 0;
+  uint64_t purged_bytes = 0;
+};
+
+struct TailCacheStats {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  // records read from memory by the readers
+  uint64_t hits = 0;
+  // lookups of records dropped already, read from the files then
+  uint64_t misses = 0;
+};
+
+struct SnapshotStats {
+  uint64_t snapshots = 0;
+  uint64_t errors = 0;
+  uint64_t last_snapshot_us = 0;
+  uint64_t last_snapshot_bytes = 0;
+  // binlog file the last snapshot is replayed from
+  uint64_t replay_from = 0;
+  uint64_t recover_us = 0;
+};
 
 class BinlogManager {
  public:
   BinlogManager(const std::string& log_path,
       rocksutil::Env* env,
-      std::shared_ptr<rocksutil::Logger> info_log)
-    : log_path_(log_path), env_(env),
+      std::shared_ptr<rocksutil::Logger> info_log,
+      const BinlogOptions& options)
+    : log_path_(log_path), env_(env), options_(options),
     number_(0), offset_(0),
     cv_(&mutex_),
-    lru_cache_(rocksutil::NewLRUCache(100000000, 0)),
-    info_log_(info_log) {}
+    conflict_table_(options),
+    info_log_(info_log),
+    tail_bytes_(0), tail_hits_(0), tail_misses_(0),
+    dispatcher_(nullptr),
+    purging_(false), purge_limit_(0),
+    purged_files_(0), purged_bytes_(0),
+    snapshotter_(nullptr), snapshotter_cv_(&snapshotter_mutex_),
+    snapshotter_should_stop_(false),
+    snapshot_number_(0), snapshot_offset_(0) {}
 
   ~BinlogManager() {
-    lru_cache_->DisownData();
+    StopDispatcher();
+    StopSnapshotter();
   }
 
   BinlogWriter* AddWriter();
+  /*
+   *  Read the records after number:offset, a record boundary such as
+   *  BinlogReader::GetOffset returns, or 0:0 to read from the oldest
+   *  binlog. Return nullptr if number is purged already
+   */
   BinlogReader* AddReader(uint64_t number, uint64_t offset);
+  /*
+   *  Whether the records after number:offset are purged, so a reader
+   *  starting there needs a full sync rather than a retry
+   */
+  bool BinlogPurged(uint64_t number, uint64_t offset);
 
   rocksutil::port::Mutex* mutex() {
     return &mutex_;
@@ -39,30 +93,159 @@ class BinlogManager {
     return &cv_;
   }
 
-  std::shared_ptr<rocksutil::Cache> lru_cache() {
-    return lru_cache_;
+  ConflictTable* conflict_table() {
+    return &conflict_table_;
   }
 
   void UpdateWriterOffset(uint64_t number, uint64_t offset);
   void GetWriterOffset(uint64_t* number, uint64_t* offset);
-  size_t GetLruMemUsage() {
-    return lru_cache_->GetUsage();
+  bool tail_cache_enabled() const {
+    return options_.tail_cache_size > 0;
   }
-  rocksutil::Status RecoverLruCache(int64_t* nums);
+  /*
+   *  Keep the record just written to binlog number from offset begin
+   *  to end in the tail cache, called by the writer with mutex() held,
+   *  so records are added in the order written. The oldest records are
+   *  dropped beyond tail_cache_size bytes
+   */
+  void AddTailRecord(uint64_t number, uint64_t begin, uint64_t end,
+      const std::shared_ptr<const std::string>& record);
+  /*
+   *  Find the record right after number:offset in the tail cache, and
+   *  the position right after it. Return false if it is not written yet
+   *  or dropped already
+   */
+  bool GetTailRecord(uint64_t number, uint64_t offset,
+      uint64_t* next_number, uint64_t* next_offset,
+      std::shared_ptr<const std::string>* record);
+  void ClearTailCache();
+  void GetTailCacheStats(TailCacheStats* stats);
+  /*
+   *  Dispatch the records from the current writer offset to the
+   *  senders, see BinlogDispatcher. The senders must be stopped before
+   *  StopDispatcher
+   */
+  int StartDispatcher();
+  void StopDispatcher();
+  BinlogDispatcher* dispatcher() {
+    return dispatcher_;
+  }
+  /*
+   *  Load the conflict snapshot if any, and replay the binlogs written
+   *  after it into the conflict table, all of them otherwise, or if
+   *  entries were spilled when it was taken
+   */
+  rocksutil::Status RecoverConflictTable(int64_t* nums);
+  /*
+   *  Save the conflict table to conflict_snapshot_path, unless nothing
+   *  was written since the last snapshot
+   */
+  rocksutil::Status SnapshotConflictTable();
+  // Snapshot the conflict table every conflict_snapshot_interval seconds
+  int StartSnapshotter();
+  void GetSnapshotStats(SnapshotStats* stats);
+  /*
+   *  Drop the conflict entries of binlog files below limit, which no
+   *  sender reads any more
+   */
+  void CollectConflictTable(uint64_t limit);
+  /*
+   *  Resume the binlogs left by the last run, truncate the torn tail of
+   *  the newest one, new records go to the file after it. Return
+   *  NotFound if there is no binlog
+   */
+  rocksutil::Status Recover();
+  /*
+   *  Remove every binlog and the conflict snapshot, and clear the
+   *  conflict table, numbering starts from 0 again
+   */
   void ResetOffsetAndBinlog();
+  /*
+   *  Purge the sealed binlogs below limit that are out of retention,
+   *  see BinlogOptions. Return Busy if another purge is running
+   */
+  rocksutil::Status PurgeBinlogs(uint64_t limit, uint64_t* purged);
+  /*
+   *  The sealed binlogs below it are older than expire_seconds, or
+   *  beyond max_total_size, 0 if none
+   */
+  uint64_t RetentionLimit();
+  void GetPurgeStats(PurgeStats* stats);
 
  private:
   std::string log_path_;
   rocksutil::Env* env_;
+  const BinlogOptions options_;
   uint64_t number_;
   uint64_t offset_;
   rocksutil::port::Mutex mutex_;
   rocksutil::port::CondVar cv_;
-  std::shared_ptr<rocksutil::Cache> lru_cache_;
+  ConflictTable conflict_table_;
   std::shared_ptr<rocksutil::Logger> info_log_;
+
+  struct TailRecord {
+    uint64_t number;
+    uint64_t begin;
+    uint64_t end;
+    std::shared_ptr<const std::string> record;
+  };
+  // protect tail_records_ & tail_bytes_
+  rocksutil::port::Mutex tail_mutex_;
+  std::deque<TailRecord> tail_records_;
+  uint64_t tail_bytes_;
+  std::atomic<uint64_t> tail_hits_;
+  std::atomic<uint64_t> tail_misses_;
+
+  BinlogDispatcher* dispatcher_;
+
+  std::atomic<bool> purging_;
+  std::atomic<uint64_t> purge_limit_;
+  std::atomic<uint64_t> purged_files_;
+  std::atomic<uint64_t> purged_bytes_;
+
+  class Snapshotter : public pink::Thread {
+   public:
+    explicit Snapshotter(BinlogManager* manager) : manager_(manager) {}
+    virtual ~Snapshotter() {}
+
+   private:
+    BinlogManager* manager_;
+    virtual void* ThreadMain() override;
+  };
+
+  Snapshotter* snapshotter_;
+  rocksutil::port::Mutex snapshotter_mutex_;
+  rocksutil::port::CondVar snapshotter_cv_;
+  bool snapshotter_should_stop_;
+  // serializes the snapshots with the binlog reset, which removes them
+  rocksutil::port::Mutex snapshot_mutex_;
+  // writer offset of the last snapshot
+  uint64_t snapshot_number_;
+  uint64_t snapshot_offset_;
+
+  struct {
+    std::atomic<uint64_t> snapshots{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> last_snapshot_us{0};
+    std::atomic<uint64_t> last_snapshot_bytes{0};
+    std::atomic<uint64_t> replay_from{0};
+    std::atomic<uint64_t> recover_us{0};
+  } snapshot_stats_;
+
+  // numbers of the binlog files in log_path_, ascending
+  rocksutil::Status ListBinlogs(std::vector<uint64_t>* numbers);
+  rocksutil::Status RemoveBinlog(uint64_t number);
+  rocksutil::Status LoadConflictSnapshot(const std::vector<uint64_t>& numbers,
+      uint64_t* replay_from);
+  // Replay the binlog files of numbers into the conflict table
+  rocksutil::Status ReplayBinlogs(const std::vector<uint64_t>& numbers,
+      int64_t* nums);
+  void BackgroundSnapshot();
+  void StopSnapshotter();
 };
 
 extern BinlogManager* CreateBinlogManager(const std::string& log_path,
-    rocksutil::Env* env, std::shared_ptr<rocksutil::Logger> info_log);
+    rocksutil::Env* env, std::shared_ptr<rocksutil::Logger> info_log,
+    const BinlogOptions& options);
 
 #endif  // SRC_PIKA_HUB_BINLOG_MANAGER_H_
@@ -6,16 +6,45 @@
 #include <utility>
 #include <memory>
 #include <string>
+#include <algorithm>
 
 #include "src/pika_hub_binlog_reader.h"
 #include "src/pika_hub_common.h"
 #include "src/pika_hub_binlog_manager.h"
+#include "src/pika_hub_binlog_compression.h"
 #include "rocksutil/file_reader_writer.h"
-#include "rocksutil/coding.h"
+#include "rocksutil/log_format.h"
 
-void BinlogReader::GetOffset(uint64_t* number, uint64_t* offset) {
-  *number = number_;
-  *offset = reader_->EndOfBufferOffset();
+static const size_t kMaxRetainedBufferSize = 16 * 1024 * 1024;
+
+// do not pin the memory of an exceptionally large record
+static void ShrinkBuffer(std::string* buffer) {
+  if (buffer->capacity() > kMaxRetainedBufferSize) {
+    std::string().swap(*buffer);
+  }
+}
+
+/*
+ *  Offset right after the record of size bytes starting at offset,
+ *  follows the fragmentation of log::Writer::AddRecord
+ */
+static uint64_t RecordEnd(uint64_t offset, size_t size) {
+  const uint64_t block_size = rocksutil::log::kBlockSize;
+  const uint64_t header_size = rocksutil::log::kHeaderSize;
+  uint64_t pos = offset;
+  uint64_t left = size;
+  do {
+    uint64_t leftover = block_size - pos % block_size;
+    if (leftover < header_size) {
+      // trailer filled with zero by the writer
+      pos += leftover;
+      leftover = block_size;
+    }
+    uint64_t fragment = std::min(left, leftover - header_size);
+    pos += header_size + fragment;
+    left -= fragment;
+  } while (left > 0);
+  return pos;
 }
 
 void BinlogReader::StopRead() {
@@ -24,21 +53,80 @@ void BinlogReader::StopRead() {
 }
 
 rocksutil::Status BinlogReader::ReadRecord(
-    std::vector<BinlogFields>* result) {
+    std::vector<BinlogFieldsView>* result) {
+  rocksutil::Slice record;
+  rocksutil::Slice content;
+  bool v2 = false;
+  rocksutil::Status s = ReadRawRecord(&record);
+  if (s.ok()) {
+    s = UncompressRecord(record, &content, &v2);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  if (!DecodeBinlogEntries(content, v2, result)) {
+    return rocksutil::Status::Corruption("bad binlog entry");
+  }
+  return rocksutil::Status::OK();
+}
+
+rocksutil::Status BinlogReader::ReadRecord(BinlogColumns* result) {
+  rocksutil::Slice record;
+  rocksutil::Slice content;
+  bool v2 = false;
+  rocksutil::Status s = ReadRawRecord(&record);
+  if (s.ok()) {
+    s = UncompressRecord(record, &content, &v2);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  if (!DecodeBinlogColumns(content, v2, result)) {
+    return rocksutil::Status::Corruption("bad binlog entry");
+  }
+  return rocksutil::Status::OK();
+}
+
+/*
+ *  The next record, still compressed, in cached_ or the file
+ */
+rocksutil::Status BinlogReader::ReadRawRecord(rocksutil::Slice* record) {
   bool ret = true;
   uint64_t writer_number = 0;
   uint64_t writer_offset = 0;
   uint64_t reader_offset = 0;
-  std::string scratch;
-  rocksutil::Slice record;
+  ShrinkBuffer(&scratch_);
   while (!should_exit_) {
-    ret = reader_->ReadRecord(&record, &scratch,
+    if (reopen_) {
+      if (ReadTailRecord()) {
+        *record = *cached_;
+        return rocksutil::Status::OK();
+      }
+      if (should_exit_) {
+        break;
+      }
+      // fell behind the tail cache
+      if (!ReopenFile()) {
+        return rocksutil::Status::IOError("reopen binlog failed",
+            std::to_string(number_));
+      }
+    }
+    cached_.reset();
+    ret = reader_->ReadRecord(record, &scratch_,
         rocksutil::log::WALRecoveryMode::kAbsoluteConsistency);
     if (ret) {
-      DecodeBinlogContent(record, result);
+      offset_ = RecordEnd(reader_->LastRecordOffset(), record->size());
       return rocksutil::Status::OK();
     } else {
       if (status_.ok()) {
+        // caught up with the file, go on with the tail cache
+        if (ReadTailRecord()) {
+          *record = *cached_;
+          return rocksutil::Status::OK();
+        }
+        if (should_exit_) {
+          break;
+        }
         manager_->mutex()->Lock();
         manager_->GetWriterOffset(&writer_number, &writer_offset);
         reader_offset = reader_->EndOfBufferOffset();
@@ -76,6 +164,33 @@ rocksutil::Status BinlogReader::ReadRecord(
   return rocksutil::Status::Corruption("Exit");
 }
 
+rocksutil::Status BinlogReader::ReadRecordInFile(
+    std::vector<BinlogFieldsView>* result, uint64_t* end) {
+  rocksutil::Slice record;
+  ShrinkBuffer(&scratch_);
+  if (!reader_->ReadRecord(&record, &scratch_,
+        rocksutil::log::WALRecoveryMode::kTolerateCorruptedTailRecords)) {
+    if (!status_.ok()) {
+      return status_;
+    }
+    return rocksutil::Status::NotFound("end of binlog file");
+  }
+  offset_ = RecordEnd(reader_->LastRecordOffset(), record.size());
+  if (end != nullptr) {
+    *end = offset_;
+  }
+  rocksutil::Slice content;
+  bool v2 = false;
+  rocksutil::Status s = UncompressRecord(record, &content, &v2);
+  if (!s.ok()) {
+    return s;
+  }
+  if (!DecodeBinlogEntries(content, v2, result)) {
+    return rocksutil::Status::Corruption("bad binlog entry");
+  }
+  return rocksutil::Status::OK();
+}
+
 rocksutil::log::Reader* CreateReader(rocksutil::Env* env,
     const std::string log_path, uint64_t num,
     uint64_t offset, rocksutil::log::Reader::LogReporter* reporter) {
@@ -105,40 +220,65 @@ bool BinlogReader::TryToRollFile() {
     delete reader_;
     reader_ = new_reader;
     number_++;
+    offset_ = 0;
     return true;
   }
   return false;
 }
 
-void BinlogReader::DecodeBinlogContent(const rocksutil::Slice& content,
-    std::vector<BinlogFields>* result) {
-  int32_t pos = 0;
-  int32_t total = content.size();
-
-  uint8_t op = 0;
-  int32_t server_id = 0;
-  int32_t exec_time = 0;
-  int32_t filenum = 0;
-  int32_t key_size = 0;
-  int32_t value_size = 0;
-
-  result->clear();
-  while (pos + 1 < total) {
-    op = static_cast<uint8_t>(*(content.data() + pos));
-    server_id = rocksutil::DecodeFixed32(content.data() + pos + 1);
-    exec_time = rocksutil::DecodeFixed32(content.data() + pos + 5);
-    filenum = rocksutil::DecodeFixed32(content.data() + pos + 9);
-    key_size = rocksutil::DecodeFixed32(content.data() + pos + 13);
-    value_size = rocksutil::DecodeFixed32(content.data() + pos
-        + 17 + key_size);
-
-    result->push_back({op, server_id, exec_time, filenum,
-        std::string(content.data() + pos + 17, key_size),
-        std::string(content.data() + pos + 21 + key_size, value_size)
-        });
-
-    pos += (21 + key_size + value_size);
+/*
+ *  Take the record after number_:offset_ from the tail cache to cached_,
+ *  and wait for it if the reader is at the end of the binlogs. Return
+ *  false if it is dropped from the cache, or should exit
+ */
+bool BinlogReader::ReadTailRecord() {
+  if (!manager_->tail_cache_enabled()) {
+    return false;
+  }
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  if (!manager_->GetTailRecord(number_, offset_, &number, &offset,
+        &cached_)) {
+    uint64_t writer_number = 0;
+    uint64_t writer_offset = 0;
+    rocksutil::MutexLock l(manager_->mutex());
+    // the writer adds records with the mutex held
+    while (!manager_->GetTailRecord(number_, offset_, &number, &offset,
+          &cached_)) {
+      manager_->GetWriterOffset(&writer_number, &writer_offset);
+      if (should_exit_ || number_ != writer_number ||
+          offset_ != writer_offset) {
+        return false;
+      }
+      manager_->cv()->Wait();
+    }
   }
+  number_ = number;
+  offset_ = offset;
+  reopen_ = true;
+  return true;
+}
+
+/*
+ *  Open the file again from offset_, the end of the last record read,
+ *  log::Reader skips the records before it in the block
+ */
+bool BinlogReader::ReopenFile() {
+  rocksutil::log::Reader* new_reader = CreateReader(env_,
+      log_path_, number_, offset_, &reporter_);
+  if (new_reader == nullptr) {
+    return false;
+  }
+  delete reader_;
+  reader_ = new_reader;
+  reopen_ = false;
+  return true;
+}
+
+rocksutil::Status BinlogReader::UncompressRecord(
+    const rocksutil::Slice& record, rocksutil::Slice* content, bool* v2) {
+  ShrinkBuffer(&uncompressed_);
+  return BinlogUncompress(record, &uncompressed_, content, v2);
 }
 
 BinlogReader* CreateBinlogReader(const std::string& log_path,
@@ -146,7 +286,7 @@ BinlogReader* CreateBinlogReader(const std::string& log_path,
     BinlogManager* manager) {
 
   BinlogReader* binlog_reader = new BinlogReader(nullptr, log_path, number,
-                                      env, manager);
+                                      offset, env, manager);
 
   rocksutil::log::Reader* reader = CreateReader(env,
       log_path, number, offset, binlog_reader->reporter());
@@ -8,8 +8,10 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "src/pika_hub_common.h"
+#include "src/pika_hub_binlog_decoder.h"
 #include "rocksutil/log_reader.h"
 #include "rocksutil/env.h"
 
@@ -19,10 +21,11 @@ class BinlogReader {
   BinlogReader(rocksutil::log::Reader* reader,
      const std::string& log_path,
      uint64_t number,
+     uint64_t offset,
      rocksutil::Env* env,
      BinlogManager* manager)
   : reader_(reader), log_path_(log_path),
-  number_(number),
+  number_(number), offset_(offset), reopen_(false),
   env_(env), manager_(manager),
   should_exit_(false) {
     reporter_.status = &status_;
@@ -32,12 +35,36 @@ class BinlogReader {
     delete reader_;
   }
 
-  rocksutil::Status ReadRecord(std::vector<BinlogFields>* result);
+  /*
+   *  Read the next record, wait for the writer at the end of the
+   *  binlogs. Records still in the tail cache of manager are read from
+   *  memory, the file is read from where they end once the reader
+   *  falls behind the cache
+   */
+  rocksutil::Status ReadRecord(std::vector<BinlogFieldsView>* result);
+  // Same as above, decode the record column by column
+  rocksutil::Status ReadRecord(BinlogColumns* result);
+  /*
+   *  Read the next record of the current file, never wait for the
+   *  writer or roll to the next file, return NotFound at the end of the
+   *  file. *end is set to the offset right after the record, as
+   *  GetOffset tells then
+   */
+  rocksutil::Status ReadRecordInFile(std::vector<BinlogFieldsView>* result,
+      uint64_t* end);
 
   bool IsEOF() {
     return reader_->IsEOF();
   }
-  void GetOffset(uint64_t* number, uint64_t* offset);
+  /*
+   *  The end of the last record read, or where the reader was created
+   *  before any read. A record boundary, BinlogManager::AddReader at it
+   *  reads exactly the records after it
+   */
+  void GetOffset(uint64_t* number, uint64_t* offset) {
+    *number = number_;
+    *offset = offset_;
+  }
 
   void set_reader(rocksutil::log::Reader* reader) {
     reader_ = reader;
@@ -50,16 +77,32 @@ class BinlogReader {
 
  private:
   bool TryToRollFile();
-  static void DecodeBinlogContent(const rocksutil::Slice& content,
-      std::vector<BinlogFields>* result);
+  bool ReadTailRecord();
+  bool ReopenFile();
+  rocksutil::Status ReadRawRecord(rocksutil::Slice* record);
+  rocksutil::Status UncompressRecord(const rocksutil::Slice& record,
+      rocksutil::Slice* content, bool* v2);
   rocksutil::log::Reader* reader_;
   std::string log_path_;
   uint64_t number_;
+  // end of the last record read
+  uint64_t offset_;
+  // records were read from the tail cache, reader_ is left behind
+  bool reopen_;
   rocksutil::Env* env_;
   BinlogManager* manager_;
   bool should_exit_;
   rocksutil::Status status_;
   rocksutil::log::Reader::LogReporter reporter_;
+  /*
+   *  The views or columns of the last read point into the block buffer of reader_,
+   *  or scratch_ for a record fragmented across blocks, or cached_ for a
+   *  record of the tail cache, or uncompressed_ for a compressed record.
+   *  They are reused from read to read
+   */
+  std::string scratch_;
+  std::shared_ptr<const std::string> cached_;
+  std::string uncompressed_;
 };
 
 extern BinlogReader* CreateBinlogReader(const std::string& log_path,
@@ -13,51 +13,136 @@
 #include "pink/include/pink_cli.h"
 #include "pink/include/redis_cli.h"
 #include "slash/include/slash_status.h"
-#include "rocksutil/cache.h"
 
-void BinlogSender::UpdateSendOffset(uint64_t* rollback) {
-  {
+// a stopping sender notices it within this
+static const uint64_t kDispatchWaitUs = 100000;
+// records sent are merged into chunks of this size in unacked_
+static const uint64_t kUnackedChunkBytes = 64 * 1024;
+
+/*
+ *  The records up to number_:offset_ are sent in bytes, slide the
+ *  resume position send_number_:send_offset_ so that it stays at least
+ *  kSendResendBytes behind them
+ */
+void BinlogSender::UpdateSendOffset(uint64_t bytes) {
+  sent_number_ = number_;
+  sent_offset_ = offset_;
+  if (bytes == 0 && unacked_.empty()) {
+    // nothing is in flight
+    send_number_ = number_;
+    send_offset_ = offset_;
+  } else if (!unacked_.empty() &&
+      (bytes == 0 || unacked_.back().bytes < kUnackedChunkBytes)) {
+    unacked_.back().number = number_;
+    unacked_.back().offset = offset_;
+    unacked_.back().bytes += bytes;
+  } else {
+    unacked_.push_back({number_, offset_, bytes});
+  }
+  unacked_bytes_ += bytes;
+  while (!unacked_.empty() &&
+      unacked_bytes_ - unacked_.front().bytes >= kSendResendBytes) {
+    send_number_ = unacked_.front().number;
+    send_offset_ = unacked_.front().offset;
+    unacked_bytes_ -= unacked_.front().bytes;
+    unacked_.pop_front();
+  }
+
   rocksutil::MutexLock l(pika_mutex_);
   auto iter = pika_servers_->find(server_id_);
   if (iter != pika_servers_->end()) {
-    reader_->GetOffset(&iter->second.send_number, &iter->second.send_offset);
+    iter->second.send_number = send_number_;
+    iter->second.send_offset = send_offset_;
+  }
+}
+
+void BinlogSender::AppendBatch(const DispatchedBatch& batch,
+    std::string* str_cmd) {
+  /*
+   *  the structure of recover_offset_ map is stable, and the value is
+   *  defined as atomic, so we modify the value without locking here
+   */
+  for (auto& filenum : batch.filenums) {
+    if (filenum.first != server_id_ &&
+        (*recover_offset_)[filenum.first][server_id_] < filenum.second) {
+      (*recover_offset_)[filenum.first][server_id_] = filenum.second;
+    }
+  }
+  size_t pos = 0;
+  for (auto& command : batch.commands) {
+    if (command.server_id != server_id_) {
+      str_cmd->append(batch.rep, pos, command.size);
+    }
+    pos += command.size;
+  }
+}
+
+/*
+ *  Take the batches from the dispatcher once the reader catches up with
+ *  it, the binlogs are decoded only once for all the senders then
+ */
+void BinlogSender::Subscribe() {
+  BinlogDispatcher* dispatcher = manager_->dispatcher();
+  if (dispatcher == nullptr || queue_ != nullptr ||
+      !dispatcher->Subscribe(number_, offset_, &queue_)) {
+    return;
   }
-  *rollback = iter->second.send_number > *rollback + 1 ?
-    iter->second.send_number - 1 : *rollback;
+  Info(info_log_, "BinlogSender[%d] take binlogs from the dispatcher at "
+      "%lu:%lu", server_id_, number_, offset_);
+  delete reader_;
+  reader_ = nullptr;
+}
+
+void BinlogSender::Unsubscribe() {
+  if (queue_ != nullptr && manager_->dispatcher() != nullptr) {
+    manager_->dispatcher()->Unsubscribe(queue_);
   }
+  queue_.reset();
 }
+
 void* BinlogSender::ThreadMain() {
   rocksutil::Status read_status;
   pink::PinkCli* cli = nullptr;
-  pink::RedisCmdArgsType args;
   std::string str_cmd;
-  std::string tmp_str;
   slash::Status s;
-  std::vector<BinlogFields> result;
+  BinlogColumns result;
+  DispatchedBatch own_batch;
   bool reset_reader = false;
-  uint64_t rollback = 0;
   while (!should_stop()) {
     if (reset_reader) {
+      Unsubscribe();
       delete reader_;
       reader_ = nullptr;
       {
       rocksutil::MutexLock l(pika_mutex_);
       auto iter = pika_servers_->find(server_id_);
       if (iter != pika_servers_->end()) {
-        // Must AddReader from offset 0, cause the send_offset persisted
-        // last time is not the true offset of the offset of last successfully
-        // read binlog record, see detail at rocksutil
-        reader_ = manager_->AddReader(rollback,
-            0);
+        /*
+         *  Read again right after the last record sent, or resend the
+         *  records the pika may not have got if the connection broke
+         */
+        if (cli == nullptr) {
+          sent_number_ = send_number_;
+          sent_offset_ = send_offset_;
+          unacked_.clear();
+          unacked_bytes_ = 0;
+        }
+        reader_ = manager_->AddReader(sent_number_, sent_offset_);
         if (reader_ == nullptr) {
           Error(info_log_, "BinlogSender[%d] AddReader error when RETRY",
               server_id_);
+          if (manager_->BinlogPurged(sent_number_, sent_offset_)) {
+            Error(info_log_, "BinlogSender[%d] binlog %lu is purged, the "
+                "pika needs a full sync", server_id_, sent_number_);
+            iter->second.sync_status = kNeedFullSync;
+          }
           iter->second.send_fd = -2;
           iter->second.sender = nullptr;
           break;
         }
-        Info(info_log_, "BinlogSender[%d] reset reader to binlog %lu",
-            server_id_, rollback);
+        reader_->GetOffset(&number_, &offset_);
+        Info(info_log_, "BinlogSender[%d] reset reader to %lu:%lu",
+            server_id_, number_, offset_);
       } else {
         Error(info_log_, "BinlogSender[%d] Cant Find server_id when RETRY",
           server_id_);
@@ -92,7 +177,8 @@ void* BinlogSender::ThreadMain() {
       continue;
     }
 
-    if (str_cmd.size() != 0) {
+    uint64_t bytes = str_cmd.size();
+    if (bytes != 0) {
       s = cli->Send(&str_cmd);
       if (!s.ok()) {
         Error(info_log_, "BinlogSender[%d] Send to %s:%d failed: %s",
@@ -108,75 +194,50 @@ void* BinlogSender::ThreadMain() {
         cli = nullptr;
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         reset_reader = true;
-        args.clear();
         str_cmd.clear();
         continue;
       }
-      args.clear();
       str_cmd.clear();
     }
+    if (number_ != sent_number_ || offset_ != sent_offset_) {
+      UpdateSendOffset(bytes);
+    }
 
-    read_status = reader_->ReadRecord(&result);
-    if (read_status.ok()) {
-      error_times_ = 0;
-      for (auto iter = result.begin(); iter != result.end();
-            iter++) {
-        if (server_id_ == iter->server_id) {
-          continue;
-        }
-
-        /*
-         *  the structure of recover_offset_ map is stable, and the value is
-         *  defined as atomic, so we modify the value without locking here
-         */
-        if ((*recover_offset_)[iter->server_id][server_id_] < iter->filenum) {
-          (*recover_offset_)[iter->server_id][server_id_] = iter->filenum;
-        }
-
-        rocksutil::Cache::Handle* handle = manager_->lru_cache()->Lookup(
-            iter->key);
-        if (handle) {
-          int32_t _exec_time = static_cast<CacheEntity*>(
-              manager_->lru_cache()->Value(handle))->exec_time;
-          if (iter->exec_time < _exec_time) {
-            manager_->lru_cache()->Release(handle);
-            continue;
-          }
-        } else {
-          Error(info_log_, "BinlogSender[%d] check LRU: %s is not in cache",
-              server_id_, iter->key.c_str());
+    if (queue_ != nullptr) {
+      DispatchedBatchPtr batch;
+      if (!queue_->Pop(&batch)) {
+        if (!queue_->closed()) {
+          queue_->Wait(kDispatchWaitUs);
           continue;
         }
-        manager_->lru_cache()->Release(handle);
-
-        switch (iter->op) {
-          case kSetOPCode:
-            args.push_back("set");
-            break;
-          case kDelOPCode:
-            args.push_back("del");
-            break;
-          case kExpireatOPCode:
-            args.push_back("expireat");
-            break;
-        }
-
-        args.push_back(iter->key);
-
-        switch (iter->op) {
-          case kSetOPCode:
-            args.push_back(iter->value);
-            break;
-          case kExpireatOPCode:
-            args.push_back(iter->value);
-            break;
+        // dropped by the dispatcher, read from where the queue ends
+        Unsubscribe();
+        Warn(info_log_, "BinlogSender[%d] fell behind the dispatcher, read "
+            "binlogs from %lu:%lu", server_id_, number_, offset_);
+        reader_ = manager_->AddReader(number_, offset_);
+        if (reader_ == nullptr) {
+          reset_reader = true;
         }
-
-        pink::SerializeRedisCommand(args, &tmp_str);
-        str_cmd.append(tmp_str);
-        args.clear();
+        continue;
       }
-      UpdateSendOffset(&rollback);
+      // published before subscribing, read by reader_ already
+      if (batch->number < number_ ||
+          (batch->number == number_ && batch->offset <= offset_)) {
+        continue;
+      }
+      AppendBatch(*batch, &str_cmd);
+      number_ = batch->number;
+      offset_ = batch->offset;
+      continue;
+    }
+
+    read_status = reader_->ReadRecord(&result);
+    if (read_status.ok()) {
+      error_times_ = 0;
+      BuildDispatchedBatch(result, manager_->conflict_table(), &own_batch);
+      AppendBatch(own_batch, &str_cmd);
+      reader_->GetOffset(&number_, &offset_);
+      Subscribe();
     } else if (read_status.IsCorruption() &&
             read_status.ToString() == "Corruption: Exit") {
       Info(info_log_, "BinlogSender[%d] Reader exit", server_id_);
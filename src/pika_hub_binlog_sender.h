@@ -8,8 +8,10 @@
 
 #include <memory>
 #include <string>
+#include <deque>
 
 #include "src/pika_hub_binlog_reader.h"
+#include "src/pika_hub_binlog_dispatcher.h"
 #include "src/pika_hub_common.h"
 #include "pink/include/pink_thread.h"
 #include "rocksutil/mutexlock.h"
@@ -32,16 +34,27 @@ class BinlogSender : public pink::Thread {
     pika_mutex_(pika_mutex),
     recover_offset_(recover_offset),
     manager_(manager),
-    error_times_(0) {}
+    error_times_(0),
+    number_(0), offset_(0),
+    sent_number_(0), sent_offset_(0),
+    send_number_(0), send_offset_(0),
+    unacked_bytes_(0) {
+    reader_->GetOffset(&number_, &offset_);
+    sent_number_ = send_number_ = number_;
+    sent_offset_ = send_offset_ = offset_;
+  }
 
   virtual ~BinlogSender() {
     set_should_stop();
-    reader_->StopRead();
+    if (reader_ != nullptr) {
+      reader_->StopRead();
+    }
     StopThread();
     delete reader_;
+    Unsubscribe();
   }
 
-  void UpdateSendOffset(uint64_t* rollback);
+  void UpdateSendOffset(uint64_t bytes);
 
  private:
   int32_t server_id_;
@@ -55,7 +68,36 @@ class BinlogSender : public pink::Thread {
   RecoverOffsetMap* recover_offset_;
   BinlogManager* manager_;
   int32_t error_times_;
+  /*
+   *  Batches from the dispatcher once caught up with it, reader_ is
+   *  deleted then
+   */
+  std::shared_ptr<DispatchQueue> queue_;
+  // the end of the last binlog record taken
+  uint64_t number_;
+  uint64_t offset_;
+  // the end of the last binlog record sent
+  uint64_t sent_number_;
+  uint64_t sent_offset_;
+  /*
+   *  Where the sender resumes once the connection breaks, kept in the
+   *  send_number & send_offset of pika_servers_ too. The records after
+   *  it were sent, but may still be in the socket buffers, unacked_
+   *  tells the end & bytes of them chunk by chunk
+   */
+  uint64_t send_number_;
+  uint64_t send_offset_;
+  struct SentChunk {
+    uint64_t number;
+    uint64_t offset;
+    uint64_t bytes;
+  };
+  std::deque<SentChunk> unacked_;
+  uint64_t unacked_bytes_;
 
+  void AppendBatch(const DispatchedBatch& batch, std::string* str_cmd);
+  void Subscribe();
+  void Unsubscribe();
   virtual void* ThreadMain() override;
 };
 
@@ -8,18 +8,27 @@
 #include <utility>
 #include <memory>
 #include <string>
+#include <thread>
+#include <chrono>
 
 #include "src/pika_hub_common.h"
 #include "src/pika_hub_binlog_manager.h"
+#include "src/pika_hub_binlog_compression.h"
 #include "rocksutil/file_reader_writer.h"
 #include "rocksutil/coding.h"
 
+static const size_t kMaxRetainedBatchCapacity = 16 * 1024 * 1024;
+// about 1~5us depending on the cpu
+static const int kWaitSpinTimes = 200;
+static const uint64_t kWaitMaxYieldUs = 100;
+
 void BinlogWriter::WriteThread::LinkOne(Executor* e,
     bool* linked_as_leader) {
   while (true) {
     Executor* executor = newest_executor_.load(std::memory_order_relaxed);
     e->link_older = executor;
     if (newest_executor_.compare_exchange_strong(executor, e)) {
+      pending_.fetch_add(1, std::memory_order_relaxed);
       *linked_as_leader = (executor == nullptr);
       return;
     }
@@ -31,13 +40,105 @@ void BinlogWriter::WriteThread::JoinTaskGroup(Executor* e) {
   LinkOne(e, &linked_as_leader);
 
   if (!linked_as_leader) {
+    AwaitState(e, kStateLeader | kStateDone);
+  } else {
+    e->state.store(kStateLeader, std::memory_order_relaxed);
+  }
+}
+
+static inline void AsmVolatilePause() {
+#if defined(__i386__) || defined(__x86_64__)
+  asm volatile("pause");
+#endif
+}
+
+uint8_t BinlogWriter::WriteThread::AwaitState(Executor* e,
+    uint8_t goal_mask) {
+  /*
+   *  1. spin, the group is usually committed within a few micros when
+   *  the binlog lands in page cache
+   */
+  uint8_t state;
+  for (int i = 0; i < kWaitSpinTimes; i++) {
+    state = e->state.load(std::memory_order_acquire);
+    if (state & goal_mask) {
+      spin_waits_.fetch_add(1, std::memory_order_relaxed);
+      return state;
+    }
+    AsmVolatilePause();
+  }
+
+  /*
+   *  2. yield, as long as the groups committed recently are fast enough,
+   *  otherwise it is cheaper to block at once
+   */
+  uint64_t yield_us = avg_group_us8_.load(std::memory_order_relaxed) / 4;
+  if (yield_us <= kWaitMaxYieldUs) {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds(yield_us);
+    do {
+      std::this_thread::yield();
+      state = e->state.load(std::memory_order_acquire);
+      if (state & goal_mask) {
+        yield_waits_.fetch_add(1, std::memory_order_relaxed);
+        return state;
+      }
+    } while (std::chrono::steady_clock::now() < deadline);
+  }
+
+  /*
+   *  3. block
+   */
+  block_waits_.fetch_add(1, std::memory_order_relaxed);
+  return BlockingAwaitState(e, goal_mask);
+}
+
+uint8_t BinlogWriter::WriteThread::BlockingAwaitState(Executor* e,
+    uint8_t goal_mask) {
+  uint8_t state = e->state.load(std::memory_order_acquire);
+  if ((state & goal_mask) == 0 &&
+      e->state.compare_exchange_strong(state, kStateLockedWaiting)) {
     rocksutil::MutexLock l(&e->mutex);
-    while (!e->leader && !e->done) {
+    while ((state = e->state.load(std::memory_order_relaxed))
+        == kStateLockedWaiting) {
       e->cv.Wait();
     }
-  } else {
-    e->leader = true;
   }
+  assert(state & goal_mask);
+  return state;
+}
+
+/*
+ *  e may return from Append and be reused as soon as new_state is
+ *  visible, so everything needed from e must be read before calling this
+ */
+void BinlogWriter::WriteThread::SetState(Executor* e, uint8_t new_state) {
+  uint8_t state = e->state.load(std::memory_order_acquire);
+  if (state == kStateLockedWaiting ||
+      !e->state.compare_exchange_strong(state, new_state)) {
+    // e is blocked, or just turned to block
+    assert(state == kStateLockedWaiting);
+    rocksutil::MutexLock l(&e->mutex);
+    e->state.store(new_state, std::memory_order_relaxed);
+    e->cv.Signal();
+  }
+}
+
+void BinlogWriter::WriteThread::UpdateGroupLatency(uint64_t group_us) {
+  /*
+   *  EWMA with alpha 1/8, kept scaled by 8 so it does not truncate
+   *  away from the mean, only the leader updates it
+   */
+  uint64_t avg8 = avg_group_us8_.load(std::memory_order_relaxed);
+  avg_group_us8_.store(avg8 - avg8 / 8 + group_us,
+      std::memory_order_relaxed);
+}
+
+void BinlogWriter::WriteThread::GetWaitStats(uint64_t* spin_waits,
+    uint64_t* yield_waits, uint64_t* block_waits) {
+  *spin_waits = spin_waits_.load(std::memory_order_relaxed);
+  *yield_waits = yield_waits_.load(std::memory_order_relaxed);
+  *block_waits = block_waits_.load(std::memory_order_relaxed);
 }
 
 void BinlogWriter::WriteThread::EnterAsTaskGroupLeader(
@@ -56,8 +157,13 @@ void BinlogWriter::WriteThread::EnterAsTaskGroupLeader(
 }
 
 void BinlogWriter::WriteThread::ExitAsTaskGroupLeader(
-    Executor* leader, Executor* last_executor,
-    const rocksutil::Status& result) {
+    Executor* leader, Executor* last_executor, uint32_t group_size) {
+  pending_.fetch_sub(group_size, std::memory_order_relaxed);
+  /*
+   *  If the group was cut before the newest executor, last_executor's
+   *  link_newer has already been set in EnterAsTaskGroupLeader, and it
+   *  becomes the next leader below
+   */
   Executor* head = newest_executor_.load(std::memory_order_acquire);
   if (head != last_executor ||
        !newest_executor_.compare_exchange_strong(head, nullptr)) {
@@ -70,24 +176,34 @@ void BinlogWriter::WriteThread::ExitAsTaskGroupLeader(
       head = next;
     }
 
-    {
-    rocksutil::MutexLock l(&(last_executor->link_newer->mutex));
-    last_executor->link_newer->link_older = nullptr;
-    last_executor->link_newer->leader = true;
-    }
-    last_executor->link_newer->cv.SignalAll();
+    Executor* next_leader = last_executor->link_newer;
+    next_leader->link_older = nullptr;
+    SetState(next_leader, kStateLeader);
   }
+}
 
-  while (last_executor != leader) {
-    rocksutil::MutexLock l(&(last_executor->mutex));
-    last_executor->status = result;
-    last_executor->done = true;
-    last_executor->cv.SignalAll();
+/*
+ *  Mark all the executors of the group done, leader included, the
+ *  leadership must have been handed over by ExitAsTaskGroupLeader
+ */
+void BinlogWriter::WriteThread::CompleteTaskGroup(Executor* leader,
+    Executor* last_executor, const rocksutil::Status& result) {
+  while (true) {
     Executor* next = last_executor->link_older;
+    bool is_leader = (last_executor == leader);
+    last_executor->status = result;
+    SetState(last_executor, kStateDone);
+    if (is_leader) {
+      break;
+    }
     last_executor = next;
   }
 }
 
+void BinlogWriter::WriteThread::AwaitCompleted(Executor* leader) {
+  AwaitState(leader, kStateDone);
+}
+
 uint64_t BinlogWriter::GetOffsetInFile() {
   return writer_->file()->GetFileSize();
 }
@@ -100,89 +216,484 @@ rocksutil::Status BinlogWriter::Append(uint8_t op, const std::string& key,
 }
 
 rocksutil::Status BinlogWriter::Append(Task* task) {
-  Executor e(task);
+  /*
+   *  Every thread has one Executor and only one Append in flight,
+   *  so the mutex & cv are built once per thread instead of per Append
+   */
+  static thread_local Executor e;
+  e.Reset(task);
+  // done by every thread in parallel, the leader only confirms it
+  manager_->conflict_table()->Prepare(task->key_, &task->prepared_);
   write_thread_.JoinTaskGroup(&e);
-  if (!e.leader && e.done) {
+  if (e.state.load(std::memory_order_acquire) == kStateDone) {
     return e.status;
   }
 
   // only LEADER reaches this point
-  assert(e.leader == true);
+  assert(e.state.load(std::memory_order_relaxed) == kStateLeader);
+  uint64_t group_start_us = env_->NowMicros();
 
-  if (GetOffsetInFile() >= kMaxBinlogFileSize) {
-    RollFile();
-  }
+  /*
+   *  With pipeline_write, wait here until one of the two batches is
+   *  free, at most one batch is queued behind the one being written
+   */
+  Batch* batch = AcquireBatch();
 
   count_++;
   assert(count_ == 1);
 
+  if (options_.group_linger_us > 0) {
+    Linger();
+  }
+
   Executor* newest_executor;
   write_thread_.EnterAsTaskGroupLeader(&newest_executor);
 
+  /*
+   *  The group goes to this binlog file or a later one, the conflict
+   *  table keeps its entries as long as senders may read this file
+   */
+  uint64_t number = 0;
+  uint64_t offset = 0;
+  {
+  rocksutil::MutexLock l(manager_->mutex());
+  manager_->GetWriterOffset(&number, &offset);
+  }
+
   Executor* last_executor = &e;
-  std::string rep;
+  uint32_t group_size = 0;
+  uint64_t group_bytes = 0;
+  std::string* rep = &batch->rep;
+  rep->clear();
   while (true) {
-    rocksutil::Cache::Handle* handle = manager_->lru_cache()->
-      Lookup(last_executor->task->key_);
-    bool valid = true;
-    if (handle) {
-      int32_t _exec_time = static_cast<CacheEntity*>(
-          manager_->lru_cache()->Value(handle))->exec_time;
-      int32_t _server_id = static_cast<CacheEntity*>(
-          manager_->lru_cache()->Value(handle))->server_id;
-      if (last_executor->task->exec_time_ < _exec_time ||
-          (last_executor->task->exec_time_ == _exec_time &&
-           last_executor->task->server_id_ != _server_id)) {
-        valid = false;
+    group_size++;
+    Task* task = last_executor->task;
+    size_t rep_size = rep->size();
+    if (manager_->conflict_table()->Update(task->key_, task->server_id_,
+          task->exec_time_, number, &task->prepared_)) {
+      if (options_.entry_version == kBinlogEntryV2) {
+        if (rep->empty()) {
+          batch->base_server_id = task->server_id_;
+          batch->base_exec_time = task->exec_time_;
+          EncodeBinlogHeaderV2(rep, batch->base_server_id,
+              batch->base_exec_time);
+        }
+        EncodeBinlogContentV2(rep, batch->base_server_id,
+            batch->base_exec_time, task->op_, task->key_, task->value_,
+            task->server_id_, task->exec_time_, task->filenum_);
+      } else {
+        EncodeBinlogContent(rep, task->op_, task->key_, task->value_,
+            task->server_id_, task->exec_time_, task->filenum_);
       }
-      manager_->lru_cache()->Release(handle);
-    }
-    if (valid) {
-      CacheEntity* entity = new CacheEntity(last_executor->task->server_id_,
-          last_executor->task->exec_time_);
-      manager_->lru_cache()->Insert(last_executor->task->key_, entity,
-          1, &CacheEntityDeleter);
-
-      rep.append(last_executor->task->rep_);
     }
+    // as encoded in the configured entry format, dropped entries take none
+    group_bytes += rep->size() - rep_size;
 
     if (last_executor == newest_executor) {
       break;
     }
+    /*
+     *  Cut the group here, the rest executors will be handed over
+     *  to the next leader in ExitAsTaskGroupLeader
+     */
+    if ((options_.group_max_records > 0 &&
+          group_size >= static_cast<uint32_t>(options_.group_max_records)) ||
+        (options_.group_max_bytes > 0 &&
+          group_bytes >= static_cast<uint64_t>(options_.group_max_bytes))) {
+      stats_.cut_groups++;
+      break;
+    }
     last_executor = last_executor->link_newer;
   }
 
-  rocksutil::Status result;
-  if (!rep.empty()) {
-    {
-    rocksutil::MutexLock l(manager_->mutex());
-    result = writer_->AddRecord(rep);
-    manager_->UpdateWriterOffset(number_, GetOffsetInFile());
-    manager_->cv()->SignalAll();
-    }
+  stats_.groups++;
+  stats_.records += group_size;
+  stats_.bytes += rep->size();
+  if (group_size > stats_.max_group_records) {
+    stats_.max_group_records = group_size;
   }
 
   count_--;
   assert(count_ == 0);
-  write_thread_.ExitAsTaskGroupLeader(&e, last_executor, result);
 
-  e.done = true;
+  if (io_thread_ == nullptr) {
+    rocksutil::Status result = WriteBatch(*rep);
+    ReleaseBatch(batch);
+    write_thread_.UpdateGroupLatency(env_->NowMicros() - group_start_us);
+    write_thread_.ExitAsTaskGroupLeader(&e, last_executor, group_size);
+    write_thread_.CompleteTaskGroup(&e, last_executor, result);
+    return result;
+  }
+
+  /*
+   *  Queue the batch before handing over the leadership, so batches
+   *  are written in the same order as the groups are built, but it is
+   *  not picked up until ReadyBatch, the executors must not be completed
+   *  before ExitAsTaskGroupLeader is done with their links. io_thread_
+   *  completes the whole group, leader included
+   */
+  batch->leader = &e;
+  batch->last_executor = last_executor;
+  batch->start_us = group_start_us;
+  SubmitBatch(batch);
+  write_thread_.ExitAsTaskGroupLeader(&e, last_executor, group_size);
+  ReadyBatch(batch);
+  write_thread_.AwaitCompleted(&e);
+  return e.status;
+}
+
+rocksutil::Status BinlogWriter::WriteBatch(const std::string& rep) {
+  if (GetOffsetInFile() >= static_cast<uint64_t>(options_.file_size)) {
+    RollFile();
+  }
+
+  rocksutil::Status result;
+  if (rep.empty()) {
+    return result;
+  }
+  rocksutil::Slice record(rep);
+  if (options_.compression != kBinlogNoCompression &&
+      rep.size() >= static_cast<size_t>(options_.compression_min_bytes)) {
+    if (BinlogCompress(options_.compression, rep, &compressed_)) {
+      record = compressed_;
+      stats_.compressed_groups++;
+    }
+  }
+  stats_.written_bytes += record.size();
+  // copied out of the mutex, readers at the tail share it
+  std::shared_ptr<const std::string> cached;
+  if (manager_->tail_cache_enabled()) {
+    cached = std::make_shared<const std::string>(record.data(),
+        record.size());
+  }
+  /*
+   *  In kBinlogSyncGroup mode the group is only published to the senders,
+   *  the dispatcher & the tail cache once it is synced, no pika applies a
+   *  record the hub may lose in a crash
+   */
+  bool sync_group = options_.sync_mode == kBinlogSyncGroup;
+  uint64_t begin = 0;
+  {
+  rocksutil::MutexLock l(manager_->mutex());
+  begin = GetOffsetInFile();
+  result = writer_->AddRecord(record);
+  written_offset_ = GetOffsetInFile();
+  if (!sync_group || !result.ok()) {
+    PublishRecord(begin, result.ok() ? cached : nullptr);
+  }
+  }
+  if (compressed_.capacity() > kMaxRetainedBatchCapacity) {
+    std::string().swap(compressed_);
+  }
+
+  if (!result.ok()) {
+    return result;
+  }
+  if (sync_group) {
+    // the whole group waits for this, out of manager_'s mutex
+    result = SyncWriter(writer_);
+    rocksutil::MutexLock l(manager_->mutex());
+    PublishRecord(begin, cached);
+  } else if (options_.sync_mode == kBinlogSyncPeriodic) {
+    // the syncer counts file offsets, compressed & framed
+    NotifySyncer(written_offset_ - begin);
+  }
   return result;
 }
 
+void BinlogWriter::PublishRecord(uint64_t begin,
+    const std::shared_ptr<const std::string>& cached) {
+  if (cached != nullptr) {
+    manager_->AddTailRecord(number_, begin, written_offset_, cached);
+  }
+  manager_->UpdateWriterOffset(number_, written_offset_);
+  manager_->cv()->SignalAll();
+}
+
+rocksutil::Status BinlogWriter::SyncWriter(rocksutil::log::Writer* writer) {
+  uint64_t start_us = env_->NowMicros();
+  // AddRecord has flushed, so it is safe with concurrent appends
+  rocksutil::Status s = writer->file()->SyncWithoutFlush(false);
+  uint64_t sync_us = env_->NowMicros() - start_us;
+  sync_stats_.syncs++;
+  sync_stats_.sync_us += sync_us;
+  if (sync_us > sync_stats_.max_sync_us) {
+    sync_stats_.max_sync_us = sync_us;
+  }
+  if (!s.ok()) {
+    sync_stats_.errors++;
+  }
+  return s;
+}
+
+void BinlogWriter::NotifySyncer(uint64_t bytes) {
+  if (options_.sync_bytes <= 0) {
+    return;
+  }
+  uint64_t sync_bytes = options_.sync_bytes;
+  uint64_t before = unsynced_bytes_.fetch_add(bytes);
+  // only wake the syncer up when crossing the threshold
+  if (before < sync_bytes && before + bytes >= sync_bytes) {
+    rocksutil::MutexLock l(&sync_mutex_);
+    sync_cv_.SignalAll();
+  }
+}
+
+/*
+ *  fdatasync writer_ every sync_interval_ms, and kick off the writeback
+ *  of every sync_bytes new bytes with RangeSync(sync_file_range), which
+ *  does not wait for the data, but keeps the next fdatasync short
+ */
+void BinlogWriter::BackgroundSync() {
+  const uint64_t interval_us =
+    static_cast<uint64_t>(options_.sync_interval_ms) * 1000;
+  const uint64_t sync_bytes = options_.sync_bytes > 0 ?
+    options_.sync_bytes : UINT64_MAX;
+  uint64_t last_sync_us = env_->NowMicros();
+  rocksutil::log::Writer* range_writer = nullptr;
+  uint64_t range_offset = 0;
+  bool should_stop = false;
+
+  while (!should_stop) {
+    std::vector<rocksutil::log::Writer*> retired;
+    rocksutil::log::Writer* writer = nullptr;
+    uint64_t offset = 0;
+    {
+    rocksutil::MutexLock l(&sync_mutex_);
+    while (!sync_should_stop_ && retired_writers_.empty() &&
+        unsynced_bytes_ < sync_bytes &&
+        env_->NowMicros() < last_sync_us + interval_us) {
+      sync_cv_.TimedWait(last_sync_us + interval_us);
+    }
+    should_stop = sync_should_stop_;
+    retired.swap(retired_writers_);
+    writer = writer_;
+    offset = written_offset_;
+    }
+
+    // the rolled files are completed, sync & close them
+    for (auto w : retired) {
+      SyncWriter(w);
+      delete w;
+    }
+
+    if (writer != range_writer) {
+      range_writer = writer;
+      range_offset = 0;
+    }
+    if (should_stop || env_->NowMicros() >= last_sync_us + interval_us) {
+      unsynced_bytes_ = 0;
+      SyncWriter(writer);
+      range_offset = offset;
+      last_sync_us = env_->NowMicros();
+    } else if (unsynced_bytes_ >= sync_bytes) {
+      unsynced_bytes_ = 0;
+      if (offset > range_offset) {
+        rocksutil::Status s = writer->file()->writable_file()->RangeSync(
+            range_offset, offset - range_offset);
+        sync_stats_.range_syncs++;
+        sync_stats_.range_sync_bytes += offset - range_offset;
+        if (!s.ok()) {
+          sync_stats_.errors++;
+        }
+        range_offset = offset;
+      }
+    }
+  }
+}
+
+void* BinlogWriter::Syncer::ThreadMain() {
+  writer_->BackgroundSync();
+  return nullptr;
+}
+
+int BinlogWriter::StartSyncer() {
+  syncer_ = new Syncer(this);
+  int ret = syncer_->StartThread();
+  if (ret != 0) {
+    delete syncer_;
+    syncer_ = nullptr;
+  }
+  return ret;
+}
+
+void BinlogWriter::StopSyncer() {
+  if (syncer_ == nullptr) {
+    return;
+  }
+  {
+  rocksutil::MutexLock l(&sync_mutex_);
+  sync_should_stop_ = true;
+  sync_cv_.SignalAll();
+  }
+  syncer_->StopThread();
+  delete syncer_;
+  syncer_ = nullptr;
+}
+
+void BinlogWriter::GetSyncStats(SyncStats* stats) {
+  stats->mode = options_.sync_mode;
+  stats->syncs = sync_stats_.syncs;
+  stats->sync_us = sync_stats_.sync_us;
+  stats->max_sync_us = sync_stats_.max_sync_us;
+  stats->range_syncs = sync_stats_.range_syncs;
+  stats->range_sync_bytes = sync_stats_.range_sync_bytes;
+  stats->errors = sync_stats_.errors;
+}
+
+BinlogWriter::Batch* BinlogWriter::AcquireBatch() {
+  rocksutil::MutexLock l(&io_mutex_);
+  while (free_batches_.empty()) {
+    io_cv_.Wait();
+  }
+  Batch* batch = free_batches_.front();
+  free_batches_.pop_front();
+  return batch;
+}
+
+void BinlogWriter::ReleaseBatch(Batch* batch) {
+  if (batch->rep.capacity() > kMaxRetainedBatchCapacity) {
+    // do not pin the memory of an exceptionally large group
+    std::string().swap(batch->rep);
+  }
+  batch->leader = nullptr;
+  batch->last_executor = nullptr;
+  rocksutil::MutexLock l(&io_mutex_);
+  batch->ready = false;
+  free_batches_.push_back(batch);
+  io_cv_.SignalAll();
+}
+
+void BinlogWriter::SubmitBatch(Batch* batch) {
+  rocksutil::MutexLock l(&io_mutex_);
+  io_queue_.push_back(batch);
+}
+
+void BinlogWriter::ReadyBatch(Batch* batch) {
+  rocksutil::MutexLock l(&io_mutex_);
+  batch->ready = true;
+  io_cv_.SignalAll();
+}
+
+bool BinlogWriter::NextBatch(Batch** batch) {
+  rocksutil::MutexLock l(&io_mutex_);
+  while (io_queue_.empty() ?
+      !io_should_stop_ : !io_queue_.front()->ready) {
+    io_cv_.Wait();
+  }
+  // drain the queue before exit, executors are waiting for it
+  if (io_queue_.empty()) {
+    return false;
+  }
+  *batch = io_queue_.front();
+  io_queue_.pop_front();
+  return true;
+}
+
+void BinlogWriter::CommitBatch(Batch* batch) {
+  rocksutil::Status result = WriteBatch(batch->rep);
+  Executor* leader = batch->leader;
+  Executor* last_executor = batch->last_executor;
+  write_thread_.UpdateGroupLatency(env_->NowMicros() - batch->start_us);
+  /*
+   *  Release the batch before completing the group, the leader may start
+   *  a new group and acquire a batch as soon as it is done
+   */
+  ReleaseBatch(batch);
+  write_thread_.CompleteTaskGroup(leader, last_executor, result);
+}
+
+void* BinlogWriter::IOThread::ThreadMain() {
+  Batch* batch = nullptr;
+  while (writer_->NextBatch(&batch)) {
+    writer_->CommitBatch(batch);
+  }
+  return nullptr;
+}
+
+int BinlogWriter::StartIOThread() {
+  io_thread_ = new IOThread(this);
+  int ret = io_thread_->StartThread();
+  if (ret != 0) {
+    delete io_thread_;
+    io_thread_ = nullptr;
+  }
+  return ret;
+}
+
+void BinlogWriter::StopIOThread() {
+  if (io_thread_ == nullptr) {
+    return;
+  }
+  {
+  rocksutil::MutexLock l(&io_mutex_);
+  io_should_stop_ = true;
+  io_cv_.SignalAll();
+  }
+  io_thread_->StopThread();
+  delete io_thread_;
+  io_thread_ = nullptr;
+}
+
+void BinlogWriter::Linger() {
+  /*
+   *  Wait for more followers to join, until the group is big enough
+   *  or group_linger_us passed
+   */
+  uint64_t start_us = env_->NowMicros();
+  uint64_t now_us = start_us;
+  while ((options_.group_max_records <= 0 || write_thread_.pending() <
+            static_cast<uint32_t>(options_.group_max_records)) &&
+      now_us - start_us < static_cast<uint64_t>(options_.group_linger_us)) {
+    std::this_thread::yield();
+    now_us = env_->NowMicros();
+  }
+  stats_.linger_us += now_us - start_us;
+}
+
+void BinlogWriter::GetGroupCommitStats(GroupCommitStats* stats) {
+  stats->groups = stats_.groups;
+  stats->records = stats_.records;
+  stats->bytes = stats_.bytes;
+  stats->max_group_records = stats_.max_group_records;
+  stats->cut_groups = stats_.cut_groups;
+  stats->linger_us = stats_.linger_us;
+  stats->compressed_groups = stats_.compressed_groups;
+  stats->written_bytes = stats_.written_bytes;
+  write_thread_.GetWaitStats(&stats->spin_waits, &stats->yield_waits,
+      &stats->block_waits);
+}
+
+static std::string BinlogFileName(const std::string& log_path,
+    uint64_t num) {
+  return log_path + "/" + kBinlogPrefix + std::to_string(num);
+}
+
+static std::string PreallocFileName(const std::string& log_path,
+    uint64_t num) {
+  return log_path + "/" + kBinlogPreallocPrefix + std::to_string(num);
+}
+
+/*
+ *  preallocate_size > 0 fallocates the file without changing its size,
+ *  readers still see the real size of what has been written
+ */
 rocksutil::log::Writer* CreateWriter(rocksutil::Env* env,
-    const std::string log_path, uint64_t num) {
+    const std::string& filename, uint64_t preallocate_size) {
 
   rocksutil::EnvOptions env_options;
   env_options.use_mmap_reads = false;
   env_options.use_mmap_writes = false;
   std::unique_ptr<rocksutil::WritableFile> writable_file;
-  std::string filename = log_path + "/" + kBinlogPrefix + std::to_string(num);
   rocksutil::Status s = NewWritableFile(env, filename,
                 &writable_file, env_options);
   if (!s.ok()) {
     return nullptr;
   }
+  if (preallocate_size > 0) {
+    // best effort, ignore the error if the filesystem does not support it
+    writable_file->Allocate(0, preallocate_size);
+  }
 
   std::unique_ptr<rocksutil::WritableFileWriter> writable_file_writer(
        new rocksutil::WritableFileWriter(std::move(writable_file),
@@ -192,26 +703,152 @@ rocksutil::log::Writer* CreateWriter(rocksutil::Env* env,
 }
 
 void BinlogWriter::RollFile() {
-  rocksutil::log::Writer* new_writer = CreateWriter(env_,
-      log_path_, number_ + 1);
+  uint64_t start_us = env_->NowMicros();
+  uint64_t new_number = number_ + 1;
+  rocksutil::log::Writer* new_writer = nullptr;
+  if (preallocator_ != nullptr) {
+    new_writer = preallocator_->Take(new_number);
+    if (new_writer != nullptr &&
+        !env_->RenameFile(PreallocFileName(log_path_, new_number),
+          BinlogFileName(log_path_, new_number)).ok()) {
+      delete new_writer;
+      new_writer = nullptr;
+    }
+    if (new_writer != nullptr) {
+      roll_stats_.preallocated_rolls++;
+    }
+  }
+  if (new_writer == nullptr) {
+    new_writer = CreateWriter(env_, BinlogFileName(log_path_, new_number), 0);
+  }
   if (new_writer != nullptr) {
-    delete writer_;
-    writer_ = new_writer;
-    number_++;
+    if (syncer_ != nullptr) {
+      // syncs & closes the old file out of the write path
+      rocksutil::MutexLock l(&sync_mutex_);
+      retired_writers_.push_back(writer_);
+      writer_ = new_writer;
+      written_offset_ = 0;
+      sync_cv_.SignalAll();
+    } else {
+      delete writer_;
+      writer_ = new_writer;
+      written_offset_ = 0;
+    }
+    number_ = new_number;
+    if (preallocator_ != nullptr) {
+      preallocator_->Request(number_ + 1);
+    }
+  }
+
+  uint64_t roll_us = env_->NowMicros() - start_us;
+  roll_stats_.rolls++;
+  if (roll_us > roll_stats_.max_roll_us) {
+    roll_stats_.max_roll_us = roll_us;
   }
 }
 
-void BinlogWriter::CacheEntityDeleter(const rocksutil::Slice& key,
-    void* value) {
-  delete static_cast<CacheEntity*>(value);
+int BinlogWriter::StartPreallocator() {
+  preallocator_ = new Preallocator(env_, log_path_, options_.file_size);
+  int ret = preallocator_->StartThread();
+  if (ret != 0) {
+    delete preallocator_;
+    preallocator_ = nullptr;
+    return ret;
+  }
+  preallocator_->Request(number_ + 1);
+  return ret;
+}
+
+void BinlogWriter::GetRollStats(RollStats* stats) {
+  stats->rolls = roll_stats_.rolls;
+  stats->preallocated_rolls = roll_stats_.preallocated_rolls;
+  stats->max_roll_us = roll_stats_.max_roll_us;
+}
+
+BinlogWriter::Preallocator::~Preallocator() {
+  {
+  rocksutil::MutexLock l(&mutex_);
+  set_should_stop();
+  cv_.SignalAll();
+  }
+  StopThread();
+  if (ready_writer_ != nullptr) {
+    Discard(ready_writer_, ready_number_);
+    ready_writer_ = nullptr;
+  }
+}
+
+void BinlogWriter::Preallocator::Request(uint64_t number) {
+  rocksutil::MutexLock l(&mutex_);
+  target_number_ = number;
+  cv_.SignalAll();
+}
+
+rocksutil::log::Writer* BinlogWriter::Preallocator::Take(uint64_t number) {
+  rocksutil::MutexLock l(&mutex_);
+  if (ready_writer_ == nullptr || ready_number_ != number) {
+    return nullptr;
+  }
+  rocksutil::log::Writer* writer = ready_writer_;
+  ready_writer_ = nullptr;
+  return writer;
+}
+
+void BinlogWriter::Preallocator::Discard(rocksutil::log::Writer* writer,
+    uint64_t number) {
+  delete writer;
+  env_->DeleteFile(PreallocFileName(log_path_, number));
+}
+
+void* BinlogWriter::Preallocator::ThreadMain() {
+  uint64_t number = 0;
+  rocksutil::log::Writer* stale = nullptr;
+  uint64_t stale_number = 0;
+  while (true) {
+    {
+    rocksutil::MutexLock l(&mutex_);
+    while (!should_stop() && (target_number_ == 0 ||
+          (ready_writer_ != nullptr && ready_number_ == target_number_))) {
+      cv_.Wait();
+    }
+    if (should_stop()) {
+      break;
+    }
+    if (ready_writer_ != nullptr) {
+      // prepared for a number the writer has rolled past
+      stale = ready_writer_;
+      stale_number = ready_number_;
+      ready_writer_ = nullptr;
+    }
+    number = target_number_;
+    }
+
+    if (stale != nullptr) {
+      Discard(stale, stale_number);
+      stale = nullptr;
+    }
+    rocksutil::log::Writer* writer = CreateWriter(env_,
+        PreallocFileName(log_path_, number), file_size_);
+
+    rocksutil::MutexLock l(&mutex_);
+    if (writer == nullptr) {
+      // retry on the next Request
+      target_number_ = 0;
+      continue;
+    }
+    ready_writer_ = writer;
+    ready_number_ = number;
+  }
+  return nullptr;
 }
 
 
+/*
+ *  Append one entry to result, result is not cleared
+ */
 void BinlogWriter::EncodeBinlogContent(std::string* result,
-    uint8_t op, const std::string& key, const std::string& value,
+    uint8_t op, const rocksutil::Slice& key, const rocksutil::Slice& value,
     int32_t server_id, int32_t exec_time, int32_t filenum) {
-  result->clear();
-
   result->append(reinterpret_cast<char*>(&op), sizeof(uint8_t));
   rocksutil::PutFixed32(result, server_id);
   rocksutil::PutFixed32(result, exec_time);
@@ -222,13 +859,48 @@ void BinlogWriter::EncodeBinlogContent(std::string* result,
   result->append(value.data(), value.size());
 }
 
+void BinlogWriter::EncodeBinlogHeaderV2(std::string* result,
+    int32_t base_server_id, int32_t base_exec_time) {
+  result->push_back(static_cast<char>(kBinlogFrameFlag | kBinlogV2Flag));
+  rocksutil::PutVarint32(result, ZigZagEncode32(base_server_id));
+  rocksutil::PutVarint32(result, ZigZagEncode32(base_exec_time));
+}
+
+void BinlogWriter::EncodeBinlogContentV2(std::string* result,
+    int32_t base_server_id, int32_t base_exec_time,
+    uint8_t op, const rocksutil::Slice& key, const rocksutil::Slice& value,
+    int32_t server_id, int32_t exec_time, int32_t filenum) {
+  result->push_back(static_cast<char>(op));
+  rocksutil::PutVarint32(result, ZigZagEncode32(
+        static_cast<int32_t>(static_cast<uint32_t>(server_id) -
+          static_cast<uint32_t>(base_server_id))));
+  rocksutil::PutVarint32(result, ZigZagEncode32(
+        static_cast<int32_t>(static_cast<uint32_t>(exec_time) -
+          static_cast<uint32_t>(base_exec_time))));
+  rocksutil::PutVarint32(result, ZigZagEncode32(filenum));
+  rocksutil::PutVarint32(result, key.size());
+  result->append(key.data(), key.size());
+  rocksutil::PutVarint32(result, value.size());
+  result->append(value.data(), value.size());
+}
+
 
 BinlogWriter* CreateBinlogWriter(const std::string& log_path,
     uint64_t number, rocksutil::Env* env,
-    BinlogManager* manager) {
+    BinlogManager* manager, const BinlogOptions& options) {
   rocksutil::log::Writer* writer = CreateWriter(env,
-      log_path, number);
-  return (writer == nullptr ?
-      nullptr : new BinlogWriter(writer, number, log_path, env,
-                      manager));
+      BinlogFileName(log_path, number), 0);
+  if (writer == nullptr) {
+    return nullptr;
+  }
+  BinlogWriter* binlog_writer = new BinlogWriter(writer, number, log_path,
+      env, manager, options);
+  if (binlog_writer->StartPreallocator() != 0 ||
+      (options.sync_mode == kBinlogSyncPeriodic &&
+       binlog_writer->StartSyncer() != 0) ||
+      (options.pipeline_write && binlog_writer->StartIOThread() != 0)) {
+    delete binlog_writer;
+    return nullptr;
+  }
+  return binlog_writer;
 }
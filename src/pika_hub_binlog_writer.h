@@ -7,27 +7,84 @@
 #define SRC_PIKA_HUB_BINLOG_WRITER_H_
 
 #include <string>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
 
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_conflict_table.h"
 #include "rocksutil/log_writer.h"
 #include "rocksutil/mutexlock.h"
 #include "rocksutil/env.h"
 #include "rocksutil/slice.h"
+#include "pink/include/pink_thread.h"
 
 class BinlogManager;
+
+struct RollStats {
+  uint64_t rolls = 0;
+  uint64_t preallocated_rolls = 0;
+  uint64_t max_roll_us = 0;
+};
+
+struct SyncStats {
+  BinlogSyncMode mode = kBinlogSyncNone;
+  uint64_t syncs = 0;
+  uint64_t sync_us = 0;
+  uint64_t max_sync_us = 0;
+  uint64_t range_syncs = 0;
+  uint64_t range_sync_bytes = 0;
+  uint64_t errors = 0;
+};
+
+struct GroupCommitStats {
+  uint64_t groups = 0;
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t max_group_records = 0;
+  uint64_t cut_groups = 0;
+  uint64_t linger_us = 0;
+  uint64_t spin_waits = 0;
+  uint64_t yield_waits = 0;
+  uint64_t block_waits = 0;
+  uint64_t compressed_groups = 0;
+  // bytes of records written to the file, after compression
+  uint64_t written_bytes = 0;
+};
+
 class BinlogWriter {
  public:
   BinlogWriter(rocksutil::log::Writer* writer,
      uint64_t number, const std::string& log_path,
      rocksutil::Env* env,
-     BinlogManager* manager)
+     BinlogManager* manager,
+     const BinlogOptions& options)
   : writer_(writer), log_path_(log_path),
     number_(number), env_(env),
-    manager_(manager), count_(0) {}
+    manager_(manager), options_(options),
+    io_cv_(&io_mutex_), io_thread_(nullptr),
+    io_should_stop_(false),
+    preallocator_(nullptr),
+    syncer_(nullptr), sync_cv_(&sync_mutex_),
+    sync_should_stop_(false), written_offset_(0),
+    unsynced_bytes_(0), count_(0) {
+    for (auto& batch : batches_) {
+      free_batches_.push_back(&batch);
+    }
+  }
 
   ~BinlogWriter() {
+    StopIOThread();
+    StopSyncer();
+    delete preallocator_;
     delete writer_;
   }
 
+  int StartIOThread();
+  int StartPreallocator();
+  int StartSyncer();
+
   uint64_t GetOffsetInFile();
   rocksutil::Status Append(uint8_t op, const std::string& key,
       const std::string& value, int32_t server_id,
@@ -37,64 +94,213 @@ class BinlogWriter {
     return number_;
   }
 
-  static void CacheEntityDeleter(const rocksutil::Slice& key, void* value);
+  void GetGroupCommitStats(GroupCommitStats* stats);
+  void GetRollStats(RollStats* stats);
+  void GetSyncStats(SyncStats* stats);
 
+
+  /*
+   *  Task only references the caller's key & value, it is encoded by the
+   *  group leader straight into batch_, the caller is blocked in Append
+   *  until the group is committed, so the references stay valid
+   */
   class Task {
    public:
     Task(uint8_t op, const std::string& key,
         const std::string& value, int32_t server_id,
         int32_t exec_time, int32_t filenum) :
-      op_(op), key_(key), server_id_(server_id),
-      exec_time_(exec_time), filenum_(filenum) {
-        EncodeBinlogContent(&rep_, op, key,
-            value, server_id, exec_time, filenum);
-    }
+      op_(op), key_(key), value_(value), server_id_(server_id),
+      exec_time_(exec_time), filenum_(filenum) {}
     uint8_t op_;
-    std::string key_;
+    const std::string& key_;
+    const std::string& value_;
     int32_t server_id_;
     int32_t exec_time_;
     int32_t filenum_;
-    std::string rep_;
+    ConflictTable::Prepared prepared_;
   };
 
+  /*
+   *  Executor state, a follower waits until it becomes kStateLeader or
+   *  kStateDone, it spins & yields first and only turns to
+   *  kStateLockedWaiting and blocks on cv if the wait takes too long
+   */
+  enum ExecutorState : uint8_t {
+    kStateInit = 1,
+    kStateLeader = 2,
+    kStateDone = 4,
+    kStateLockedWaiting = 8
+  };
+
+  /*
+   *  One Executor per thread, reused by every Append of that thread,
+   *  see BinlogWriter::Append
+   */
   struct Executor {
     Task* task;
-    bool leader;
-    bool done;
+    std::atomic<uint8_t> state;
     rocksutil::Status status;
     Executor* link_older;
     Executor* link_newer;
     rocksutil::port::Mutex mutex;
     rocksutil::port::CondVar cv;
-    explicit Executor(Task* t) :
-      task(t),
-      leader(false),
-      done(false),
+    Executor() :
+      task(nullptr),
+      state(kStateInit),
       link_older(nullptr),
       link_newer(nullptr),
       cv(&mutex) {}
+    void Reset(Task* t) {
+      task = t;
+      state.store(kStateInit, std::memory_order_relaxed);
+      status = rocksutil::Status::OK();
+      link_older = nullptr;
+      link_newer = nullptr;
+    }
   };
 
   class WriteThread {
    public:
     WriteThread() :
-      newest_executor_(nullptr) {}
+      newest_executor_(nullptr),
+      pending_(0),
+      avg_group_us8_(0),
+      spin_waits_(0),
+      yield_waits_(0),
+      block_waits_(0) {}
     void JoinTaskGroup(Executor* e);
     void EnterAsTaskGroupLeader(Executor** newest_executor);
     void ExitAsTaskGroupLeader(Executor* leader, Executor* last_executor,
+          uint32_t group_size);
+    void CompleteTaskGroup(Executor* leader, Executor* last_executor,
           const rocksutil::Status& result);
-
+    void AwaitCompleted(Executor* leader);
+    // executors linked but not yet committed, including the leader
+    uint32_t pending() {
+      return pending_.load(std::memory_order_relaxed);
+    }
+    // feed the latency of a group, used to tune how long followers yield
+    void UpdateGroupLatency(uint64_t group_us);
+    void GetWaitStats(uint64_t* spin_waits, uint64_t* yield_waits,
+        uint64_t* block_waits);
 
    private:
     void LinkOne(Executor* e, bool* linked_as_leader);
+    uint8_t AwaitState(Executor* e, uint8_t goal_mask);
+    uint8_t BlockingAwaitState(Executor* e, uint8_t goal_mask);
+    static void SetState(Executor* e, uint8_t new_state);
     std::atomic<Executor*> newest_executor_;
+    std::atomic<uint32_t> pending_;
+    // the average group latency times 8
+    std::atomic<uint64_t> avg_group_us8_;
+    std::atomic<uint64_t> spin_waits_;
+    std::atomic<uint64_t> yield_waits_;
+    std::atomic<uint64_t> block_waits_;
+  };
+
+  /*
+   *  The encoded records of a group and the executors waiting for it,
+   *  with pipeline_write, one Batch is written by io_thread_ while the
+   *  next leader builds the other one
+   */
+  struct Batch {
+    std::string rep;
+    // v2 header of rep, from the first valid entry
+    int32_t base_server_id;
+    int32_t base_exec_time;
+    Executor* leader;
+    Executor* last_executor;
+    uint64_t start_us;
+    // set once the leader has handed over its leadership
+    bool ready;
+    Batch() : base_server_id(0), base_exec_time(0),
+      leader(nullptr), last_executor(nullptr), start_us(0),
+      ready(false) {}
+  };
+
+  class IOThread : public pink::Thread {
+   public:
+    explicit IOThread(BinlogWriter* writer) : writer_(writer) {}
+    virtual ~IOThread() {}
+
+   private:
+    BinlogWriter* writer_;
+    virtual void* ThreadMain() override;
+  };
+
+  // Used by kBinlogSyncPeriodic, see BinlogWriter::BackgroundSync
+  class Syncer : public pink::Thread {
+   public:
+    explicit Syncer(BinlogWriter* writer) : writer_(writer) {}
+    virtual ~Syncer() {}
+
+   private:
+    BinlogWriter* writer_;
+    virtual void* ThreadMain() override;
+  };
+
+  /*
+   *  Creates & fallocates the next binlog file in background under a
+   *  temporary name, so RollFile only renames it and swaps the pointer
+   */
+  class Preallocator : public pink::Thread {
+   public:
+    Preallocator(rocksutil::Env* env, const std::string& log_path,
+        uint64_t file_size)
+      : env_(env), log_path_(log_path), file_size_(file_size),
+        cv_(&mutex_), target_number_(0),
+        ready_writer_(nullptr), ready_number_(0) {}
+    virtual ~Preallocator();
+
+    // prepare binlog file number in background
+    void Request(uint64_t number);
+    // return the prepared writer of number, or nullptr if not ready
+    rocksutil::log::Writer* Take(uint64_t number);
+
+   private:
+    rocksutil::Env* env_;
+    const std::string log_path_;
+    const uint64_t file_size_;
+    rocksutil::port::Mutex mutex_;
+    rocksutil::port::CondVar cv_;
+    uint64_t target_number_;
+    rocksutil::log::Writer* ready_writer_;
+    uint64_t ready_number_;
+
+    void Discard(rocksutil::log::Writer* writer, uint64_t number);
+    virtual void* ThreadMain() override;
   };
 
  private:
   void RollFile();
+  void Linger();
   rocksutil::Status Append(Task* task);
+  rocksutil::Status WriteBatch(const std::string& rep);
+  /*
+   *  Make the record written from begin visible to the readers, with
+   *  manager_'s mutex held
+   */
+  void PublishRecord(uint64_t begin,
+      const std::shared_ptr<const std::string>& cached);
+  Batch* AcquireBatch();
+  void ReleaseBatch(Batch* batch);
+  void SubmitBatch(Batch* batch);
+  void ReadyBatch(Batch* batch);
+  bool NextBatch(Batch** batch);
+  void CommitBatch(Batch* batch);
+  void StopIOThread();
+  rocksutil::Status SyncWriter(rocksutil::log::Writer* writer);
+  void NotifySyncer(uint64_t bytes);
+  void BackgroundSync();
+  void StopSyncer();
   static void EncodeBinlogContent(std::string* result,
-      uint8_t op, const std::string& key, const std::string& value,
+      uint8_t op, const rocksutil::Slice& key, const rocksutil::Slice& value,
+      int32_t server_id, int32_t exec_time, int32_t filenum);
+  static void EncodeBinlogHeaderV2(std::string* result,
+      int32_t base_server_id, int32_t base_exec_time);
+  static void EncodeBinlogContentV2(std::string* result,
+      int32_t base_server_id, int32_t base_exec_time,
+      uint8_t op, const rocksutil::Slice& key, const rocksutil::Slice& value,
       int32_t server_id, int32_t exec_time, int32_t filenum);
 
   rocksutil::log::Writer* writer_;
@@ -102,12 +308,68 @@ class BinlogWriter {
   uint64_t number_;
   rocksutil::Env* env_;
   BinlogManager* manager_;
+  const BinlogOptions options_;
   WriteThread write_thread_;
+  // reused by group leaders to encode the group's records
+  Batch batches_[2];
+  // reused by WriteBatch to hold the compressed records
+  std::string compressed_;
+  // protected by io_mutex_
+  std::deque<Batch*> free_batches_;
+  std::deque<Batch*> io_queue_;
+  rocksutil::port::Mutex io_mutex_;
+  rocksutil::port::CondVar io_cv_;
+  IOThread* io_thread_;
+  bool io_should_stop_;
+  Preallocator* preallocator_;
+  Syncer* syncer_;
+  /*
+   *  With syncer_ running, writer_ is swapped under sync_mutex_ and
+   *  the old writers are handed to syncer_ to be synced & closed
+   */
+  rocksutil::port::Mutex sync_mutex_;
+  rocksutil::port::CondVar sync_cv_;
+  bool sync_should_stop_;
+  std::vector<rocksutil::log::Writer*> retired_writers_;
+  // offset of writer_ that has been written
+  std::atomic<uint64_t> written_offset_;
+  // bytes written since the last range sync
+  std::atomic<uint64_t> unsynced_bytes_;
   std::atomic<int> count_;
+
+  /*
+   *  Only modified by the group leader, so there is no contention,
+   *  they are atomic just for InfoCmd reading them concurrently
+   */
+  struct {
+    std::atomic<uint64_t> groups{0};
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> max_group_records{0};
+    std::atomic<uint64_t> cut_groups{0};
+    std::atomic<uint64_t> linger_us{0};
+    std::atomic<uint64_t> compressed_groups{0};
+    std::atomic<uint64_t> written_bytes{0};
+  } stats_;
+
+  struct {
+    std::atomic<uint64_t> rolls{0};
+    std::atomic<uint64_t> preallocated_rolls{0};
+    std::atomic<uint64_t> max_roll_us{0};
+  } roll_stats_;
+
+  struct {
+    std::atomic<uint64_t> syncs{0};
+    std::atomic<uint64_t> sync_us{0};
+    std::atomic<uint64_t> max_sync_us{0};
+    std::atomic<uint64_t> range_syncs{0};
+    std::atomic<uint64_t> range_sync_bytes{0};
+    std::atomic<uint64_t> errors{0};
+  } sync_stats_;
 };
 
 extern BinlogWriter* CreateBinlogWriter(const std::string& log_path,
     uint64_t number, rocksutil::Env* env,
-    BinlogManager* manager);
+    BinlogManager* manager, const BinlogOptions& options);
 
 #endif  // SRC_PIKA_HUB_BINLOG_WRITER_H_
@@ -55,6 +55,12 @@ void InitCmdInfoTable() {
   cmd_infos.insert(std::pair<std::string, CmdInfo*>(kCmdNameRemove,
         removeptr));
 
+  // Purgelogs
+  CmdInfo* purgelogsptr = new CmdInfo(kCmdNamePurgelogs, -1,
+      kCmdFlagsWrite | kCmdFlagsAdmin);
+  cmd_infos.insert(std::pair<std::string, CmdInfo*>(kCmdNamePurgelogs,
+        purgelogsptr));
+
   // Set
   CmdInfo* setptr = new CmdInfo(kCmdNameSet, 7,
       kCmdFlagsWrite);
@@ -118,6 +124,11 @@ void InitCmdTable(std::unordered_map<std::string, Cmd*> *cmd_table) {
   cmd_table->insert(std::pair<std::string, Cmd*>(kCmdNameRemove,
         removeptr));
 
+  // Purgelogs
+  Cmd* purgelogsptr = new PurgelogsCmd();
+  cmd_table->insert(std::pair<std::string, Cmd*>(kCmdNamePurgelogs,
+        purgelogsptr));
+
 
   // Set
   Cmd* setptr = new SetCmd();
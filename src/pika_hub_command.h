@@ -23,6 +23,7 @@ const char kCmdNameCopy[] = "copy";
 const char kCmdNameAuth[] = "auth";
 const char kCmdNameAdd[]  = "add";
 const char kCmdNameRemove[] = "remove";
+const char kCmdNamePurgelogs[] = "purgelogs";
 
 //  Sync command
 const char kCmdNameSet[] = "set";
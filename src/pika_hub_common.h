@@ -14,7 +14,8 @@ enum SyncStatus {
   kShouldConnect = 0,
   kConnected,
   kErrorHappened,
-  kShouldDelete
+  kShouldDelete,
+  kNeedFullSync
 };
 
 struct PikaStatus {
@@ -39,39 +40,156 @@ typedef std::map<int32_t, PikaStatus> PikaServers;
 typedef std::map<int32_t,
         std::map<int32_t, std::atomic<int32_t> > > RecoverOffsetMap;
 
-struct BinlogFields {
-  uint8_t op;
-  int32_t server_id;
-  int32_t exec_time;
-  int32_t filenum;
-  std::string key;
-  std::string value;
-};
-
-struct CacheEntity {
-  CacheEntity(int32_t _server_id,
-      int32_t _exec_time)
-    : server_id(_server_id),
-      exec_time(_exec_time) {}
-  int32_t server_id;
-  int32_t exec_time;
-};
-
 const uint8_t kSetOPCode = 1;
 const uint8_t kDelOPCode = 2;
 const uint8_t kExpireatOPCode = 3;
 
+// op(1) server_id(4) exec_time(4) filenum(4) key_size(4) value_size(4)
+const int32_t kBinlogEntryHeaderSize = 21;
+
 const char kBinlogPrefix[] = "binlog_";
+// the next binlog file is created under this name before rolled to
+const char kBinlogPreallocPrefix[] = "prealloc_binlog_";
 const int32_t kMaxBinlogFileSize = 100 * 1024 * 1024;
 const char kBinlogMagic[] = "__PIKA_X#$SKGI";
 const char kLockName[] = "pika_hub_lock#68";
 const char kLeaseKey[] = "pika_hub_lease#68";
+// send positions of the primary, only valid for its own binlogs
+const char kSendOffsetKey[] = "pika_hub_send_offset#68";
 
 const int32_t kMaxRecvRollbackNums = 12;
+// binlogs are resumed, only the file being received may be incomplete
+const int32_t kResumeRecvRollbackNums = 1;
 const int32_t kMaxRetryTimes = 10;
+/*
+ *  Commands written to the socket are never acked by pika, a sender
+ *  reconnecting resends at least this many bytes before the last record
+ *  sent, more than the socket buffers of both ends hold
+ */
+const uint64_t kSendResendBytes = 16 * 1024 * 1024;  // 16MB
 const int32_t kPikaPortInterval = 1100;
 const int32_t kMaxFloydErrorTimes = 10;
 const int32_t kLockDuration = 10;  // 10s
 const int32_t kLeaseDuration = 60;  // 60s
 
+const int32_t kDefaultGroupMaxRecords = 1024;
+const int32_t kDefaultGroupMaxBytes = 4 * 1024 * 1024;  // 4MB
+const int32_t kDefaultGroupLingerUs = 0;
+const int32_t kDefaultSyncIntervalMs = 1000;
+const int32_t kDefaultSyncBytes = 4 * 1024 * 1024;  // 4MB
+const int32_t kDefaultCompressionMinBytes = 256;
+const int32_t kDefaultExpireFiles = 100;
+const int32_t kDefaultExpireSeconds = 7 * 24 * 3600;  // 7 days
+const int64_t kDefaultTailCacheSize = 64LL * 1024 * 1024;  // 64MB
+const int32_t kDefaultDispatchQueueSize = 1024;
+// see pika_hub_conflict_table.h
+const int32_t kConflictTableShardBits = 6;
+const int32_t kConflictTableShards = 1 << kConflictTableShardBits;
+const size_t kConflictTableInitSlots = 1024;  // per shard, power of 2
+// key slabs of a shard double from min to max size
+const size_t kConflictTableMinSlabSize = 64 * 1024;
+const size_t kConflictTableSlabSize = 2 * 1024 * 1024;
+const int64_t kDefaultConflictMaxMemory = 4LL * 1024 * 1024 * 1024;
+const int32_t kConflictTableMaxSingleWriterBits = 32;
+// lock-free readers of the table spread over them, a thread keeps its own
+const int32_t kConflictTableReaderSlots = 256;
+const uint32_t kConflictSnapshotMagic = 0x70686373;
+const int32_t kDefaultConflictSnapshotInterval = 300;  // seconds
+// binlog files read, and shards replayed, in parallel by recovery
+const int32_t kConflictRecoverThreads = 8;
+// see pika_hub_binlog_format.h
+const int32_t kBinlogEntryV1 = 1;
+const int32_t kBinlogEntryV2 = 2;
+
+/*
+ *  Durability of the binlog:
+ *  kBinlogSyncNone: only written to page cache, flushed by the OS
+ *  kBinlogSyncGroup: fdatasync every group before acknowledging it
+ *  kBinlogSyncPeriodic: a background syncer fdatasyncs every
+ *    sync_interval_ms, and starts writeback with sync_file_range
+ *    whenever sync_bytes are written, so the final fdatasync is cheap
+ */
+enum BinlogSyncMode {
+  kBinlogSyncNone = 0,
+  kBinlogSyncGroup = 1,
+  kBinlogSyncPeriodic = 2
+};
+
+// the value is stored in binlog records, never change it
+enum BinlogCompressionType : uint8_t {
+  kBinlogNoCompression = 0,
+  kBinlogSnappyCompression = 1,
+  kBinlogLZ4Compression = 2,
+  kBinlogZSTDCompression = 3
+};
+
+/*
+ *  Group commit policy of BinlogWriter, a group is cut once it holds
+ *  group_max_records records or group_max_bytes bytes, the rest
+ *  executors will be committed by the next leader. A leader may linger
+ *  group_linger_us micros to collect more followers before committing,
+ *  0 means never linger. With pipeline_write, groups are written by a
+ *  dedicated io thread, so the next group is built while the previous
+ *  one is being written. A binlog file is rolled once it exceeds
+ *  file_size bytes, the next file is always created & preallocated in
+ *  background, so rolling does not stall the write path. sync_mode
+ *  is described in BinlogSyncMode. Each group is compressed as a whole
+ *  with compression if it is at least compression_min_bytes.
+ *  entry_version selects the entry encoding of new records, readers
+ *  handle both.
+ *
+ *  Binlogs below every sender's watermark are purged, oldest first,
+ *  as long as there are more than expire_files files, the file is
+ *  older than expire_seconds or the binlogs take more than
+ *  max_total_size bytes, 0 disables a rule. Purged files are moved
+ *  to archive_path if it is set, deleted otherwise. The last two rules
+ *  also hold against the watermark of an unconnected pika, which then
+ *  needs a full sync.
+ *
+ *  The newest tail_cache_size bytes of binlog records are also kept in
+ *  memory, senders at the tail read them from there instead of the
+ *  files, 0 disables it. Records at the tail are decoded & conflict
+ *  checked once for all the senders, and handed to each of them through
+ *  a queue of dispatch_queue_size records, 0 disables it.
+ *
+ *  The conflict table is backed by transparent huge pages with
+ *  conflict_huge_page, and stores key fingerprints instead of keys
+ *  with conflict_fingerprint, see pika_hub_conflict_table.h. Beyond
+ *  conflict_max_memory bytes, 0 means no limit, the table drops the
+ *  entries no sender needs, then evicts its oldest entries to a RocksDB
+ *  in conflict_spill_path, without one it grows over the limit.
+ *  A limit below the least the table takes is raised to it.
+ *  Keys only written by one pika skip the table with a single writer
+ *  filter of 2^conflict_single_writer_bits cells, 0 disables it.
+ *  The table is saved to conflict_snapshot_path every
+ *  conflict_snapshot_interval seconds, so recovery only replays the
+ *  binlogs written after the snapshot, an empty path disables it.
+ */
+struct BinlogOptions {
+  int32_t group_max_records = kDefaultGroupMaxRecords;
+  int32_t group_max_bytes = kDefaultGroupMaxBytes;
+  int32_t group_linger_us = kDefaultGroupLingerUs;
+  bool pipeline_write = false;
+  int32_t file_size = kMaxBinlogFileSize;
+  BinlogSyncMode sync_mode = kBinlogSyncNone;
+  int32_t sync_interval_ms = kDefaultSyncIntervalMs;
+  int32_t sync_bytes = kDefaultSyncBytes;
+  BinlogCompressionType compression = kBinlogNoCompression;
+  int32_t compression_min_bytes = kDefaultCompressionMinBytes;
+  int32_t entry_version = kBinlogEntryV1;
+  int32_t expire_files = kDefaultExpireFiles;
+  int32_t expire_seconds = kDefaultExpireSeconds;
+  int64_t max_total_size = 0;
+  std::string archive_path;
+  int64_t tail_cache_size = kDefaultTailCacheSize;
+  int32_t dispatch_queue_size = kDefaultDispatchQueueSize;
+  bool conflict_huge_page = false;
+  bool conflict_fingerprint = false;
+  int64_t conflict_max_memory = kDefaultConflictMaxMemory;
+  std::string conflict_spill_path;
+  int32_t conflict_single_writer_bits = 0;
+  std::string conflict_snapshot_path;
+  int32_t conflict_snapshot_interval = kDefaultConflictSnapshotInterval;
+};
+
 #endif  // SRC_PIKA_HUB_COMMON_H_
@@ -8,7 +8,28 @@
 #include <algorithm>
 
 PikaHubConf::PikaHubConf(const std::string& conf_path)
-  : slash::BaseConf(conf_path), conf_path_(conf_path) {
+  : slash::BaseConf(conf_path), conf_path_(conf_path),
+  binlog_group_max_records_(kDefaultGroupMaxRecords),
+  binlog_group_max_bytes_(kDefaultGroupMaxBytes),
+  binlog_group_linger_us_(kDefaultGroupLingerUs),
+  binlog_pipeline_write_(false),
+  binlog_file_size_(kMaxBinlogFileSize),
+  binlog_sync_mode_(kBinlogSyncNone),
+  binlog_sync_interval_ms_(kDefaultSyncIntervalMs),
+  binlog_sync_bytes_(kDefaultSyncBytes),
+  binlog_compression_(kBinlogNoCompression),
+  binlog_compression_min_bytes_(kDefaultCompressionMinBytes),
+  binlog_entry_version_(kBinlogEntryV1),
+  binlog_expire_files_(kDefaultExpireFiles),
+  binlog_expire_seconds_(kDefaultExpireSeconds),
+  binlog_max_total_size_(0),
+  binlog_tail_cache_size_(kDefaultTailCacheSize),
+  binlog_dispatch_queue_size_(kDefaultDispatchQueueSize),
+  conflict_table_huge_page_(false),
+  conflict_table_fingerprint_(false),
+  conflict_table_max_memory_(kDefaultConflictMaxMemory),
+  conflict_table_single_writer_bits_(0),
+  conflict_table_snapshot_interval_(kDefaultConflictSnapshotInterval) {
 }
 
 int PikaHubConf::Load() {
@@ -42,5 +63,96 @@ int PikaHubConf::Load() {
 
   GetConfStr("pidfile", &pidfile_);
   GetConfStr("requirepass", &requirepass_);
+
+  GetConfInt("binlog-group-max-records", &binlog_group_max_records_);
+  GetConfInt("binlog-group-max-bytes", &binlog_group_max_bytes_);
+  GetConfInt("binlog-group-linger-us", &binlog_group_linger_us_);
+
+  str.clear();
+  GetConfStr("binlog-pipeline-write", &str);
+  std::transform(str.begin(), str.end(),
+      str.begin(), ::tolower);
+  binlog_pipeline_write_ = str == "yes" ? true : false;
+
+  GetConfInt("binlog-file-size", &binlog_file_size_);
+  if (binlog_file_size_ <= 0) {
+    binlog_file_size_ = kMaxBinlogFileSize;
+  }
+
+  str.clear();
+  GetConfStr("binlog-sync-mode", &str);
+  std::transform(str.begin(), str.end(),
+      str.begin(), ::tolower);
+  if (str == "group") {
+    binlog_sync_mode_ = kBinlogSyncGroup;
+  } else if (str == "periodic") {
+    binlog_sync_mode_ = kBinlogSyncPeriodic;
+  } else {
+    binlog_sync_mode_ = kBinlogSyncNone;
+  }
+  GetConfInt("binlog-sync-interval-ms", &binlog_sync_interval_ms_);
+  if (binlog_sync_interval_ms_ <= 0) {
+    binlog_sync_interval_ms_ = kDefaultSyncIntervalMs;
+  }
+  GetConfInt("binlog-sync-bytes", &binlog_sync_bytes_);
+
+  str.clear();
+  GetConfStr("binlog-compression", &str);
+  std::transform(str.begin(), str.end(),
+      str.begin(), ::tolower);
+  if (str == "snappy") {
+    binlog_compression_ = kBinlogSnappyCompression;
+  } else if (str == "lz4") {
+    binlog_compression_ = kBinlogLZ4Compression;
+  } else if (str == "zstd") {
+    binlog_compression_ = kBinlogZSTDCompression;
+  } else {
+    binlog_compression_ = kBinlogNoCompression;
+  }
+  GetConfInt("binlog-compression-min-bytes", &binlog_compression_min_bytes_);
+
+  GetConfInt("binlog-entry-version", &binlog_entry_version_);
+  if (binlog_entry_version_ != kBinlogEntryV2) {
+    binlog_entry_version_ = kBinlogEntryV1;
+  }
+
+  GetConfInt("binlog-expire-files", &binlog_expire_files_);
+  GetConfInt("binlog-expire-seconds", &binlog_expire_seconds_);
+  str.clear();
+  GetConfStr("binlog-max-total-size", &str);
+  if (!str.empty()) {
+    binlog_max_total_size_ = std::strtoll(str.c_str(), nullptr, 10);
+  }
+  GetConfStr("binlog-archive-path", &binlog_archive_path_);
+  str.clear();
+  GetConfStr("binlog-tail-cache-size", &str);
+  if (!str.empty()) {
+    binlog_tail_cache_size_ = std::strtoll(str.c_str(), nullptr, 10);
+  }
+  GetConfInt("binlog-dispatch-queue-size", &binlog_dispatch_queue_size_);
+
+  str.clear();
+  GetConfStr("conflict-table-huge-page", &str);
+  std::transform(str.begin(), str.end(),
+      str.begin(), ::tolower);
+  conflict_table_huge_page_ = str == "yes" ? true : false;
+
+  str.clear();
+  GetConfStr("conflict-table-fingerprint", &str);
+  std::transform(str.begin(), str.end(),
+      str.begin(), ::tolower);
+  conflict_table_fingerprint_ = str == "yes" ? true : false;
+
+  str.clear();
+  GetConfStr("conflict-table-max-memory", &str);
+  if (!str.empty()) {
+    conflict_table_max_memory_ = std::strtoll(str.c_str(), nullptr, 10);
+  }
+  GetConfStr("conflict-table-spill-path", &conflict_table_spill_path_);
+  GetConfInt("conflict-table-single-writer-bits",
+      &conflict_table_single_writer_bits_);
+  GetConfStr("conflict-table-snapshot-path", &conflict_table_snapshot_path_);
+  GetConfInt("conflict-table-snapshot-interval",
+      &conflict_table_snapshot_interval_);
   return 0;
 }
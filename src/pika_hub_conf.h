@@ -8,6 +8,7 @@
 
 #include <string>
 
+#include "src/pika_hub_common.h"
 #include "slash/include/base_conf.h"
 #include "rocksutil/mutexlock.h"
 
@@ -75,6 +76,102 @@ class PikaHubConf : public slash::BaseConf {
     rocksutil::ReadLock l(&rw_mutex_);
     return requirepass_;
   }
+  int binlog_group_max_records() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_group_max_records_;
+  }
+  int binlog_group_max_bytes() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_group_max_bytes_;
+  }
+  int binlog_group_linger_us() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_group_linger_us_;
+  }
+  bool binlog_pipeline_write() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_pipeline_write_;
+  }
+  int binlog_file_size() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_file_size_;
+  }
+  BinlogSyncMode binlog_sync_mode() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_sync_mode_;
+  }
+  int binlog_sync_interval_ms() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_sync_interval_ms_;
+  }
+  int binlog_sync_bytes() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_sync_bytes_;
+  }
+  BinlogCompressionType binlog_compression() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_compression_;
+  }
+  int binlog_compression_min_bytes() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_compression_min_bytes_;
+  }
+  int binlog_entry_version() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_entry_version_;
+  }
+  int binlog_expire_files() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_expire_files_;
+  }
+  int binlog_expire_seconds() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_expire_seconds_;
+  }
+  int64_t binlog_max_total_size() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_max_total_size_;
+  }
+  std::string binlog_archive_path() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_archive_path_;
+  }
+  int64_t binlog_tail_cache_size() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_tail_cache_size_;
+  }
+  int binlog_dispatch_queue_size() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return binlog_dispatch_queue_size_;
+  }
+  bool conflict_table_huge_page() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_huge_page_;
+  }
+  bool conflict_table_fingerprint() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_fingerprint_;
+  }
+  int64_t conflict_table_max_memory() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_max_memory_;
+  }
+  std::string conflict_table_spill_path() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_spill_path_;
+  }
+  int conflict_table_single_writer_bits() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_single_writer_bits_;
+  }
+  std::string conflict_table_snapshot_path() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_snapshot_path_;
+  }
+  int conflict_table_snapshot_interval() {
+    rocksutil::ReadLock l(&rw_mutex_);
+    return conflict_table_snapshot_interval_;
+  }
 
   int Load();
 
@@ -94,6 +191,30 @@ class PikaHubConf : public slash::BaseConf {
   std::string pidfile_;
   bool binlog_offset_absolute_consistency_;
   std::string requirepass_;
+  int binlog_group_max_records_;
+  int binlog_group_max_bytes_;
+  int binlog_group_linger_us_;
+  bool binlog_pipeline_write_;
+  int binlog_file_size_;
+  BinlogSyncMode binlog_sync_mode_;
+  int binlog_sync_interval_ms_;
+  int binlog_sync_bytes_;
+  BinlogCompressionType binlog_compression_;
+  int binlog_compression_min_bytes_;
+  int binlog_entry_version_;
+  int binlog_expire_files_;
+  int binlog_expire_seconds_;
+  int64_t binlog_max_total_size_;
+  std::string binlog_archive_path_;
+  int64_t binlog_tail_cache_size_;
+  int binlog_dispatch_queue_size_;
+  bool conflict_table_huge_page_;
+  bool conflict_table_fingerprint_;
+  int64_t conflict_table_max_memory_;
+  std::string conflict_table_spill_path_;
+  int conflict_table_single_writer_bits_;
+  std::string conflict_table_snapshot_path_;
+  int conflict_table_snapshot_interval_;
 
   rocksutil::port::RWMutex rw_mutex_;
 };
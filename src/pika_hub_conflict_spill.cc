@@ -0,0 +1,79 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/pika_hub_conflict_spill.h"
+
+#include <string>
+
+#include "rocksutil/coding.h"
+
+static const size_t kSpillValueSize = 12;
+
+ConflictSpill::~ConflictSpill() {
+  delete db_;
+}
+
+rocksdb::Status ConflictSpill::Open(const std::string& path,
+    ConflictSpill** spill) {
+  ConflictSpill* s = new ConflictSpill();
+  s->path_ = path;
+  s->options_.create_if_missing = true;
+  s->options_.compaction_filter = &s->filter_;
+  // point lookups only, by the writer and the senders
+  s->options_.OptimizeForPointLookup(64);
+
+  rocksdb::Status status = s->Clear();
+  if (!status.ok()) {
+    delete s;
+    return status;
+  }
+  *spill = s;
+  return status;
+}
+
+rocksdb::Status ConflictSpill::Clear() {
+  delete db_;
+  db_ = nullptr;
+  rocksdb::Status status = rocksdb::DestroyDB(path_, options_);
+  if (status.ok()) {
+    status = rocksdb::DB::Open(options_, path_, &db_);
+  }
+  return status;
+}
+
+void ConflictSpill::Put(rocksdb::WriteBatch* batch,
+    const rocksdb::Slice& key, int32_t server_id, int32_t exec_time,
+    uint32_t number) {
+  std::string value;
+  rocksutil::PutFixed32(&value, server_id);
+  rocksutil::PutFixed32(&value, exec_time);
+  rocksutil::PutFixed32(&value, number);
+  batch->Put(key, value);
+}
+
+rocksdb::Status ConflictSpill::Write(rocksdb::WriteBatch* batch) {
+  rocksdb::WriteOptions write_options;
+  write_options.disableWAL = true;
+  return db_->Write(write_options, batch);
+}
+
+bool ConflictSpill::Get(const rocksdb::Slice& key, int32_t* server_id,
+    int32_t* exec_time) {
+  std::string value;
+  rocksdb::Status s = db_->Get(rocksdb::ReadOptions(), key, &value);
+  if (!s.ok() || value.size() != kSpillValueSize) {
+    return false;
+  }
+  *server_id = rocksutil::DecodeFixed32(value.data());
+  *exec_time = rocksutil::DecodeFixed32(value.data() + 4);
+  return true;
+}
+
+bool ConflictSpill::CollectFilter::Filter(int level,
+    const rocksdb::Slice& key, const rocksdb::Slice& existing_value,
+    std::string* new_value, bool* value_changed) const {
+  return existing_value.size() != kSpillValueSize ||
+    rocksutil::DecodeFixed32(existing_value.data() + 8) < limit;
+}
@@ -0,0 +1,73 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_CONFLICT_SPILL_H_
+#define SRC_PIKA_HUB_CONFLICT_SPILL_H_
+
+#include <string>
+#include <atomic>
+
+#include "rocksdb/db.h"
+#include "rocksdb/compaction_filter.h"
+#include "rocksdb/write_batch.h"
+
+/*
+ *  Spill tier of ConflictTable in a local RocksDB, the entries evicted
+ *  from memory are kept here instead of being lost. The value of a key
+ *  is Fixed32 server_id, Fixed32 exec_time and Fixed32 binlog number.
+ *
+ *  It is only a cache of the binlogs, which rebuild it on recovery, so
+ *  it is destroyed on open and written without WAL. Entries collected
+ *  from memory are dropped here by compaction.
+ */
+class ConflictSpill {
+ public:
+  ~ConflictSpill();
+
+  static rocksdb::Status Open(const std::string& path,
+      ConflictSpill** spill);
+  /*
+   *  Drop every entry by destroying and opening the RocksDB again, no
+   *  Get or Write may run meanwhile. It is unusable if this fails
+   */
+  rocksdb::Status Clear();
+
+  void Put(rocksdb::WriteBatch* batch, const rocksdb::Slice& key,
+      int32_t server_id, int32_t exec_time, uint32_t number);
+  rocksdb::Status Write(rocksdb::WriteBatch* batch);
+  // Return false if key is not spilled
+  bool Get(const rocksdb::Slice& key, int32_t* server_id,
+      int32_t* exec_time);
+  // Entries of binlog files below limit are dropped by compaction
+  void Collect(uint32_t limit) {
+    filter_.limit = limit;
+  }
+
+ private:
+  class CollectFilter : public rocksdb::CompactionFilter {
+   public:
+    CollectFilter() : limit(0) {}
+    virtual bool Filter(int level, const rocksdb::Slice& key,
+        const rocksdb::Slice& existing_value, std::string* new_value,
+        bool* value_changed) const override;
+    virtual const char* Name() const override {
+      return "pika_hub.ConflictCollectFilter";
+    }
+    std::atomic<uint32_t> limit;
+  };
+
+  ConflictSpill() : db_(nullptr) {}
+
+  std::string path_;
+  rocksdb::Options options_;
+  rocksdb::DB* db_;
+  CollectFilter filter_;
+
+  // No copying allowed
+  ConflictSpill(const ConflictSpill&);
+  void operator=(const ConflictSpill&);
+};
+
+#endif  // SRC_PIKA_HUB_CONFLICT_SPILL_H_
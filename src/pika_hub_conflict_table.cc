@@ -0,0 +1,1098 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/pika_hub_conflict_table.h"
+
+#include <sys/mman.h>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
+
+#include "src/pika_hub_common.h"
+#include "rocksutil/coding.h"
+
+ConflictTable::ConflictTable(const BinlogOptions& options)
+  : huge_page_(options.conflict_huge_page),
+    fingerprint_(options.conflict_fingerprint),
+    slot_size_(fingerprint_ ? sizeof(FingerprintSlot) : sizeof(KeySlot)),
+    max_memory_(options.conflict_max_memory > 0 ?
+        options.conflict_max_memory : 0),
+    max_shard_memory_(max_memory_ / kConflictTableShards),
+    evictions_(0), collected_(0), over_budget_(0), collect_limit_(0),
+    spill_(nullptr), spilled_(0), spill_hits_(0), spill_errors_(0),
+    shards_(new Shard[kConflictTableShards]),
+    epoch_(1),
+    reader_slots_(new ReaderSlot[kConflictTableReaderSlots]),
+    cells_(nullptr),
+    cell_bits_(0),
+    contended_cells_(0),
+    updates_(0), update_hits_(0), lookups_(0), lookup_hits_(0),
+    prepared_(0), prepared_hits_(0) {
+  /*
+   *  A shard never takes less than its smallest array, grown once, and
+   *  a slab of keys, a smaller budget would evict it empty on every
+   *  growth
+   */
+  size_t min_shard_memory = 2 * kConflictTableInitSlots * slot_size_ +
+    (fingerprint_ ? 0 : kConflictTableMinSlabSize);
+  if (max_memory_ > 0 && max_shard_memory_ < min_shard_memory) {
+    max_shard_memory_ = min_shard_memory;
+    max_memory_ = max_shard_memory_ * kConflictTableShards;
+  }
+  for (int i = 0; i < kConflictTableShards; i++) {
+    shards_[i].array.store(NewSlotArray(kConflictTableInitSlots));
+  }
+  for (int i = 0; i < kConflictTableReaderSlots; i++) {
+    reader_slots_[i].epoch.store(0, std::memory_order_relaxed);
+  }
+  if (options.conflict_single_writer_bits > 0) {
+    // a cell belongs to one shard, whose mutex serializes its writers
+    cell_bits_ = std::min(std::max(options.conflict_single_writer_bits,
+          kConflictTableShardBits), kConflictTableMaxSingleWriterBits);
+    size_t cells = static_cast<size_t>(1) << cell_bits_;
+    cells_ = new std::atomic<uint64_t>[cells];
+    for (size_t i = 0; i < cells; i++) {
+      cells_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+ConflictTable::~ConflictTable() {
+  for (int i = 0; i < kConflictTableShards; i++) {
+    Shard* shard = &shards_[i];
+    DeleteSlotArray(shard->array.load());
+    for (auto& slab : shard->slabs) {
+      Deallocate(slab.first, slab.second);
+    }
+    Reclaim(shard);
+  }
+  delete[] shards_;
+  delete[] reader_slots_;
+  delete spill_;
+  delete[] cells_;
+}
+
+rocksdb::Status ConflictTable::OpenSpill(const std::string& path) {
+  return ConflictSpill::Open(path, &spill_);
+}
+
+/*
+ *  MurmurHash64A, the high bits choose the shard and the low bits the
+ *  slot, so both need to be well mixed
+ */
+uint64_t ConflictTable::HashKey(const rocksutil::Slice& key) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const char* data = key.data();
+  size_t len = key.size();
+  uint64_t h = 0x9747b28cULL ^ (len * m);
+
+  const char* end = data + (len / 8) * 8;
+  for (; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  if (len & 7) {
+    uint64_t k = 0;
+    for (size_t i = len & 7; i > 0; i--) {
+      k = (k << 8) | static_cast<uint8_t>(data[i - 1]);
+    }
+    h ^= k;
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+char* ConflictTable::Allocate(size_t bytes) {
+  if (huge_page_) {
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+    return static_cast<char*>(ptr);
+  }
+  return new char[bytes];
+}
+
+void ConflictTable::Deallocate(char* ptr, size_t bytes) {
+  if (huge_page_) {
+    munmap(ptr, bytes);
+  } else {
+    delete[] ptr;
+  }
+}
+
+ConflictTable::SlotArray* ConflictTable::NewSlotArray(size_t capacity) {
+  SlotArray* array = new SlotArray;
+  array->capacity = capacity;
+  array->slots = Allocate(capacity * slot_size_);
+  memset(array->slots, 0, capacity * slot_size_);
+  return array;
+}
+
+void ConflictTable::DeleteSlotArray(SlotArray* array) {
+  Deallocate(array->slots, array->capacity * slot_size_);
+  delete array;
+}
+
+const char* ConflictTable::CopyKey(Shard* shard,
+    const rocksutil::Slice& key) {
+  static const char kEmptyKey[] = "";
+  if (key.size() == 0) {
+    // slots with a null key are empty
+    return kEmptyKey;
+  }
+  if (key.size() > kConflictTableSlabSize / 4) {
+    // big keys get their own slab, not to waste the rest of the current
+    char* ptr = Allocate(key.size());
+    shard->slabs.push_back(std::make_pair(ptr, key.size()));
+    shard->slab_bytes += key.size();
+    memcpy(ptr, key.data(), key.size());
+    return ptr;
+  }
+  if (key.size() > shard->alloc_remaining) {
+    size_t slab_size = shard->slabs.empty() ? kConflictTableMinSlabSize :
+      std::min(shard->slabs.back().second * 2, kConflictTableSlabSize);
+    slab_size = std::max(slab_size, kConflictTableMinSlabSize);
+    shard->alloc_ptr = Allocate(slab_size);
+    shard->alloc_remaining = slab_size;
+    shard->slabs.push_back(std::make_pair(shard->alloc_ptr, slab_size));
+    shard->slab_bytes += slab_size;
+  }
+  char* ptr = shard->alloc_ptr;
+  memcpy(ptr, key.data(), key.size());
+  shard->alloc_ptr += key.size();
+  shard->alloc_remaining -= key.size();
+  return ptr;
+}
+
+/*
+ *  Return the slot of key, or the empty slot it should go to. Readers
+ *  may call it while the slots are modified, the result is validated by
+ *  the shard version then, the probe is bounded in case of a torn view
+ */
+ConflictTable::KeySlot* ConflictTable::FindSlot(KeySlot* slots,
+    size_t capacity, uint64_t hash, const rocksutil::Slice& key,
+    size_t index) {
+  size_t mask = capacity - 1;
+  size_t i = index != SIZE_MAX ? index : hash & mask;
+  for (size_t n = 0; n < capacity; n++) {
+    KeySlot* slot = &slots[i];
+    const char* slot_key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (slot_key == nullptr ||
+        (slot->hash == hash && slot->key_size == key.size() &&
+         memcmp(slot_key, key.data(), key.size()) == 0)) {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+  return nullptr;
+}
+
+// 0 marks an empty slot, the fingerprint of the hash 0 is 1
+static inline uint64_t Fingerprint(uint64_t hash) {
+  return hash == 0 ? 1 : hash;
+}
+
+ConflictTable::FingerprintSlot* ConflictTable::FindSlot(
+    FingerprintSlot* slots, size_t capacity, uint64_t hash,
+    const rocksutil::Slice& key, size_t index) {
+  uint64_t fingerprint = Fingerprint(hash);
+  size_t mask = capacity - 1;
+  size_t i = index != SIZE_MAX ? index : fingerprint & mask;
+  for (size_t n = 0; n < capacity; n++) {
+    FingerprintSlot* slot = &slots[i];
+    uint64_t slot_fingerprint = __atomic_load_n(&slot->fingerprint,
+        __ATOMIC_ACQUIRE);
+    if (slot_fingerprint == 0 || slot_fingerprint == fingerprint) {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+  return nullptr;
+}
+
+rocksdb::Slice ConflictTable::SpillKey(const FingerprintSlot* slot,
+    std::string* buf) {
+  buf->clear();
+  rocksutil::PutFixed64(buf, slot->fingerprint);
+  return rocksdb::Slice(*buf);
+}
+
+rocksdb::Slice ConflictTable::SpillKey(uint64_t hash,
+    const rocksutil::Slice& key, std::string* buf) {
+  if (!fingerprint_) {
+    return rocksdb::Slice(key.data(), key.size());
+  }
+  buf->clear();
+  rocksutil::PutFixed64(buf, Fingerprint(hash));
+  return rocksdb::Slice(*buf);
+}
+
+bool ConflictTable::IsEmpty(const KeySlot* slot) {
+  return __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE) == nullptr;
+}
+
+bool ConflictTable::IsEmpty(const FingerprintSlot* slot) {
+  return __atomic_load_n(&slot->fingerprint, __ATOMIC_ACQUIRE) == 0;
+}
+
+void ConflictTable::Fill(Shard* shard, KeySlot* slot, uint64_t hash,
+    const rocksutil::Slice& key) {
+  const char* slot_key = CopyKey(shard, key);
+  slot->hash = hash;
+  slot->key_size = key.size();
+  __atomic_store_n(&slot->key, slot_key, __ATOMIC_RELEASE);
+}
+
+void ConflictTable::Fill(Shard* shard, FingerprintSlot* slot, uint64_t hash,
+    const rocksutil::Slice& key) {
+  __atomic_store_n(&slot->fingerprint, Fingerprint(hash), __ATOMIC_RELEASE);
+}
+
+void ConflictTable::BeginWrite(Shard* shard) {
+  shard->version.fetch_add(1, std::memory_order_relaxed);
+  // the odd version is visible before any modification
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ConflictTable::EndWrite(Shard* shard) {
+  shard->version.fetch_add(1, std::memory_order_release);
+}
+
+size_t ConflictTable::ShardMemory(Shard* shard) {
+  return shard->array.load(std::memory_order_relaxed)->capacity *
+    slot_size_ + shard->slab_bytes + shard->retired_bytes;
+}
+
+/*
+ *  The slot is claimed before the array is loaded, both seq_cst, so a
+ *  writer retiring the array after the reader loaded it sees the slot
+ *  with an epoch not newer than the retirement
+ */
+ConflictTable::ReaderSlot* ConflictTable::EnterRead() {
+  static std::atomic<uint32_t> next_thread(0);
+  thread_local uint32_t thread_index =
+    next_thread.fetch_add(1, std::memory_order_relaxed);
+  uint64_t epoch = epoch_.load();
+  for (uint32_t i = thread_index; ; i++) {
+    // only taken by a thread sharing it, the next one is tried then
+    ReaderSlot* slot = &reader_slots_[i % kConflictTableReaderSlots];
+    uint64_t expected = 0;
+    if (slot->epoch.load(std::memory_order_relaxed) == 0 &&
+        slot->epoch.compare_exchange_strong(expected, epoch)) {
+      return slot;
+    }
+  }
+}
+
+void ConflictTable::ExitRead(ReaderSlot* slot) {
+  slot->epoch.store(0, std::memory_order_release);
+}
+
+void ConflictTable::Retire(Shard* shard, SlotArray* array, bool slabs) {
+  // readers entered at this epoch or before may still be probing them
+  uint64_t epoch = epoch_.fetch_add(1);
+  Retired retired = { epoch, array, nullptr, array->capacity * slot_size_ };
+  shard->retired.push_back(retired);
+  shard->retired_bytes += retired.bytes;
+  if (!slabs) {
+    return;
+  }
+  for (auto& slab : shard->slabs) {
+    retired = { epoch, nullptr, slab.first, slab.second };
+    shard->retired.push_back(retired);
+    shard->retired_bytes += retired.bytes;
+  }
+  shard->slabs.clear();
+  shard->slab_bytes = 0;
+  shard->alloc_ptr = nullptr;
+  shard->alloc_remaining = 0;
+}
+
+void ConflictTable::Reclaim(Shard* shard) {
+  if (shard->retired.empty()) {
+    return;
+  }
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < kConflictTableReaderSlots; i++) {
+    uint64_t epoch = reader_slots_[i].epoch.load();
+    if (epoch != 0) {
+      oldest = std::min(oldest, epoch);
+    }
+  }
+  // readers entered after a retirement see the new array only
+  size_t kept = 0;
+  for (auto& retired : shard->retired) {
+    if (retired.epoch >= oldest) {
+      shard->retired[kept++] = retired;
+      continue;
+    }
+    if (retired.array != nullptr) {
+      DeleteSlotArray(retired.array);
+    } else {
+      Deallocate(retired.slab, retired.bytes);
+    }
+    shard->retired_bytes -= retired.bytes;
+  }
+  shard->retired.resize(kept);
+}
+
+template <typename Slot>
+void ConflictTable::Rebuild(Shard* shard, size_t capacity,
+    int32_t evict_before, uint32_t collect_before, bool compact) {
+  SlotArray* old_array = shard->array.load(std::memory_order_relaxed);
+  Slot* old_slots = reinterpret_cast<Slot*>(old_array->slots);
+  size_t live = 0;
+  size_t slab_size = 0;
+  for (size_t j = 0; j < old_array->capacity; j++) {
+    if (!IsEmpty(&old_slots[j]) &&
+        old_slots[j].exec_time >= evict_before &&
+        old_slots[j].number >= collect_before) {
+      live++;
+      slab_size += KeySize(&old_slots[j]);
+    }
+  }
+  if (capacity == 0) {
+    capacity = CapacityFor(live);
+  }
+  SlotArray* array = NewSlotArray(capacity);
+  Slot* slots = reinterpret_cast<Slot*>(array->slots);
+
+  char* slab = nullptr;
+  if (compact && slab_size > 0) {
+    slab = Allocate(slab_size);
+  }
+
+  size_t size = 0;
+  size_t slab_offset = 0;
+  uint32_t min_number = UINT32_MAX;
+  size_t mask = capacity - 1;
+  for (size_t j = 0; j < old_array->capacity; j++) {
+    if (IsEmpty(&old_slots[j]) || old_slots[j].exec_time < evict_before ||
+        old_slots[j].number < collect_before) {
+      continue;
+    }
+    min_number = std::min(min_number, old_slots[j].number);
+    size_t i = SlotHash(&old_slots[j]) & mask;
+    while (!IsEmpty(&slots[i])) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = old_slots[j];
+    if (slab != nullptr && KeySize(&slots[i]) > 0) {
+      MoveKey(&slots[i], slab + slab_offset);
+      slab_offset += KeySize(&slots[i]);
+    }
+    size++;
+  }
+  shard->array.store(array);
+  shard->generation.fetch_add(1, std::memory_order_relaxed);
+
+  Retire(shard, old_array, compact);
+  if (slab != nullptr) {
+    shard->slabs.push_back(std::make_pair(slab, slab_size));
+    shard->slab_bytes = slab_size;
+  }
+  shard->size = size;
+  shard->min_number = size > 0 ? min_number : 0;
+}
+
+size_t ConflictTable::CapacityFor(size_t size) {
+  size_t capacity = kConflictTableInitSlots;
+  while (capacity < size * 2) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+/*
+ *  Write the entries older than evict_before to the spill tier, before
+ *  they are dropped from memory, so readers find them in one of both.
+ *  Return false if the write failed, they must not be dropped then
+ */
+template <typename Slot>
+bool ConflictTable::Spill(Shard* shard, int32_t evict_before) {
+  SlotArray* array = shard->array.load(std::memory_order_relaxed);
+  Slot* slots = reinterpret_cast<Slot*>(array->slots);
+  rocksdb::WriteBatch batch;
+  std::string buf;
+  uint64_t count = 0;
+  uint32_t number = 0;
+  for (size_t j = 0; j < array->capacity; j++) {
+    if (!IsEmpty(&slots[j]) && slots[j].exec_time < evict_before) {
+      spill_->Put(&batch, SpillKey(&slots[j], &buf), slots[j].server_id,
+          slots[j].exec_time, slots[j].number);
+      number = std::max(number, slots[j].number);
+      count++;
+    }
+  }
+  if (count == 0) {
+    return true;
+  }
+  if (!spill_->Write(&batch).ok()) {
+    spill_errors_++;
+    return false;
+  }
+  spilled_ += count;
+  shard->spilled_number = std::max(shard->spilled_number, number);
+  return true;
+}
+
+/*
+ *  Free the retired memory, drop the entries below the last collect
+ *  limit, then spill and drop the oldest quarter of the entries until
+ *  the shard fits in its budget. Memory retired by each rebuild is freed
+ *  right after it unless a reader is still in. Called with the shard
+ *  mutex held, the entries are picked and spilled before the version
+ *  goes odd, so Lookups never wait for the spill write
+ */
+template <typename Slot>
+void ConflictTable::Evict(Shard* shard) {
+  Reclaim(shard);
+  uint32_t limit = collect_limit_.load(std::memory_order_relaxed);
+  if (ShardMemory(shard) > max_shard_memory_ && shard->size > 0 &&
+      shard->min_number < limit) {
+    size_t old_size = shard->size;
+    BeginWrite(shard);
+    Rebuild<Slot>(shard, 0, INT32_MIN, limit, true);
+    EndWrite(shard);
+    collected_ += old_size - shard->size;
+    Reclaim(shard);
+  }
+  if (ShardMemory(shard) <= max_shard_memory_) {
+    return;
+  }
+  if (spill_ == nullptr) {
+    // every entry left may still decide a conflict, none is dropped
+    over_budget_++;
+    return;
+  }
+
+  std::vector<int32_t> exec_times;
+  while (shard->size > 0 && ShardMemory(shard) > max_shard_memory_) {
+    SlotArray* array = shard->array.load(std::memory_order_relaxed);
+    Slot* slots = reinterpret_cast<Slot*>(array->slots);
+    exec_times.clear();
+    for (size_t j = 0; j < array->capacity; j++) {
+      if (!IsEmpty(&slots[j])) {
+        exec_times.push_back(slots[j].exec_time);
+      }
+    }
+    auto nth = exec_times.begin() + exec_times.size() / 4;
+    std::nth_element(exec_times.begin(), nth, exec_times.end());
+    int32_t evict_before = *nth;
+    if (std::count_if(exec_times.begin(), exec_times.end(),
+          [evict_before](int32_t t) { return t < evict_before; }) == 0) {
+      // the oldest quarter share one exec_time
+      evict_before = evict_before == INT32_MAX ? INT32_MAX : evict_before + 1;
+    }
+
+    if (!Spill<Slot>(shard, evict_before)) {
+      // over budget until the next insert retries, rather than lose them
+      return;
+    }
+    size_t old_size = shard->size;
+    BeginWrite(shard);
+    Rebuild<Slot>(shard, 0, evict_before, 0, true);
+    EndWrite(shard);
+    evictions_ += old_size - shard->size;
+    Reclaim(shard);
+    if (shard->size == old_size) {
+      // every entry left is as new as evict_before, nothing to drop
+      break;
+    }
+  }
+}
+
+template <typename Slot>
+void ConflictTable::CollectShard(Shard* shard, uint32_t limit) {
+  rocksutil::MutexLock l(&shard->mutex);
+  if (shard->size > 0 && shard->min_number < limit) {
+    size_t old_size = shard->size;
+    BeginWrite(shard);
+    Rebuild<Slot>(shard, 0, INT32_MIN, limit, true);
+    EndWrite(shard);
+    collected_ += old_size - shard->size;
+  }
+  if (cells_ != nullptr) {
+    ReleaseCells<Slot>(shard, limit);
+  }
+  Reclaim(shard);
+}
+
+/*
+ *  A contended cell whose floor and entries are all below limit is no
+ *  more needed than the entries Collect drops, so it is cleared for a
+ *  new single writer. Entries spilled from the shard may be of any of
+ *  its cells, none is cleared until the spill tier dropped them all
+ */
+template <typename Slot>
+void ConflictTable::ReleaseCells(Shard* shard, uint32_t limit) {
+  if (shard->contended.empty() || shard->spilled_number >= limit) {
+    return;
+  }
+  std::unordered_set<size_t> idle;
+  for (auto& cell : shard->contended) {
+    if (cell.second < limit) {
+      idle.insert(cell.first);
+    }
+  }
+  if (idle.empty()) {
+    return;
+  }
+  SlotArray* array = shard->array.load(std::memory_order_relaxed);
+  Slot* slots = reinterpret_cast<Slot*>(array->slots);
+  for (size_t j = 0; j < array->capacity && !idle.empty(); j++) {
+    if (!IsEmpty(&slots[j])) {
+      idle.erase(SlotHash(&slots[j]) >> (64 - cell_bits_));
+    }
+  }
+  for (auto index : idle) {
+    // Lookups see an empty cell and probe the table, which misses
+    cells_[index].store(0, std::memory_order_release);
+    shard->contended.erase(index);
+    contended_cells_--;
+  }
+}
+
+void ConflictTable::Collect(uint64_t limit) {
+  uint32_t number_limit = static_cast<uint32_t>(
+      std::min(limit, static_cast<uint64_t>(UINT32_MAX)));
+  collect_limit_.store(number_limit, std::memory_order_relaxed);
+  if (spill_ != nullptr) {
+    spill_->Collect(number_limit);
+  }
+  for (int i = 0; i < kConflictTableShards; i++) {
+    if (fingerprint_) {
+      CollectShard<FingerprintSlot>(&shards_[i], number_limit);
+    } else {
+      CollectShard<KeySlot>(&shards_[i], number_limit);
+    }
+  }
+}
+
+void ConflictTable::Reset() {
+  for (int i = 0; i < kConflictTableShards; i++) {
+    Shard* shard = &shards_[i];
+    rocksutil::MutexLock l(&shard->mutex);
+    SlotArray* old_array = shard->array.load(std::memory_order_relaxed);
+    BeginWrite(shard);
+    shard->array.store(NewSlotArray(kConflictTableInitSlots));
+    shard->generation.fetch_add(1, std::memory_order_relaxed);
+    EndWrite(shard);
+
+    Retire(shard, old_array, true);
+    shard->size = 0;
+    shard->min_number = 0;
+    shard->spilled_number = 0;
+    shard->contended.clear();
+    Reclaim(shard);
+  }
+  for (size_t i = 0; i < single_writer_cells(); i++) {
+    cells_[i].store(0, std::memory_order_relaxed);
+  }
+  contended_cells_ = 0;
+  collect_limit_ = 0;
+  if (spill_ != nullptr && !spill_->Clear().ok()) {
+    // evicted entries are dropped from now on
+    delete spill_;
+    spill_ = nullptr;
+  }
+  spilled_ = 0;
+}
+
+/*
+ *  A cell is a tag in its high 32 bits and the newest exec_time of its
+ *  key in the low 32 bits. The tag holds server_id + 1 of the only
+ *  writer in bits 16 to 30, 0 if none, the 16-bit fingerprint of the
+ *  only key in bits 0 to 15, and kContended once a second writer or
+ *  key came, until ReleaseCells clears it
+ */
+static const uint32_t kContended = 0x80000000;
+static const int kWriterShift = 16;
+static const uint32_t kCellKeyMask = 0xffff;
+
+static inline uint32_t WriterTag(int32_t server_id) {
+  // server ids not fitting in a tag always go through the table
+  return server_id >= 0 && server_id < 0x7fff ?
+    static_cast<uint32_t>(server_id + 1) << kWriterShift : 0;
+}
+
+static inline uint32_t CellKey(uint64_t hash) {
+  // the cell index takes the top bits
+  return static_cast<uint32_t>(hash) & kCellKeyMask;
+}
+
+static inline uint64_t Cell(uint32_t tag, int32_t exec_time) {
+  return static_cast<uint64_t>(tag) << 32 | static_cast<uint32_t>(exec_time);
+}
+
+bool ConflictTable::UpdateCell(Shard* shard, uint64_t hash,
+    int32_t server_id, int32_t exec_time, uint32_t number, Floor* floor,
+    bool* accepted) {
+  size_t index = hash >> (64 - cell_bits_);
+  std::atomic<uint64_t>* cell = &cells_[index];
+  uint64_t value = cell->load(std::memory_order_relaxed);
+  uint32_t tag = static_cast<uint32_t>(value >> 32);
+  int32_t newest = static_cast<int32_t>(static_cast<uint32_t>(value));
+  uint32_t writer_tag = WriterTag(server_id);
+  uint32_t key_tag = writer_tag | CellKey(hash);
+  if (writer_tag != 0 && (tag == 0 || tag == key_tag)) {
+    update_hits_++;
+    // the same rule as a slot, a write as new from the same server wins
+    *accepted = tag == 0 || exec_time >= newest;
+    if (*accepted) {
+      cell->store(Cell(key_tag, exec_time), std::memory_order_release);
+    }
+    return true;
+  }
+  if (!(tag & kContended)) {
+    tag |= kContended;
+    cell->store(Cell(tag, newest), std::memory_order_release);
+    shard->contended[index] = number;
+    contended_cells_++;
+  }
+  uint32_t former = (tag & ~kContended) >> kWriterShift;
+  floor->has_floor = former != 0 && (tag & kCellKeyMask) == CellKey(hash);
+  floor->server_id = static_cast<int32_t>(former) - 1;
+  floor->exec_time = newest;
+  return false;
+}
+
+bool ConflictTable::LookupCell(uint64_t hash) {
+  uint64_t value = cells_[hash >> (64 - cell_bits_)].load(
+      std::memory_order_acquire);
+  uint32_t tag = static_cast<uint32_t>(value >> 32);
+  return tag != 0 && !(tag & kContended);
+}
+
+template <typename Slot>
+void ConflictTable::PrepareSlot(Shard* shard, const rocksutil::Slice& key,
+    Prepared* prepared) {
+  Slot* slot = nullptr;
+  ReaderSlot* reader = EnterRead();
+  while (true) {
+    uint64_t version = shard->version.load(std::memory_order_acquire);
+    if (version & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    prepared->generation = shard->generation.load(std::memory_order_relaxed);
+    SlotArray* array = shard->array.load();
+    Slot* slots = reinterpret_cast<Slot*>(array->slots);
+    slot = FindSlot(slots, array->capacity, prepared->hash, key);
+    if (slot != nullptr) {
+      prepared->index = slot - slots;
+      prepared->found = !IsEmpty(slot);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (shard->version.load(std::memory_order_relaxed) == version) {
+      break;
+    }
+  }
+  ExitRead(reader);
+  if (slot == nullptr) {
+    return;
+  }
+
+  prepared->spilled = false;
+  std::string buf;
+  if (!prepared->found && spill_ != nullptr && spilled_ > 0) {
+    prepared->spilled = spill_->Get(SpillKey(prepared->hash, key, &buf),
+        &prepared->spilled_server_id, &prepared->spilled_exec_time);
+  }
+  prepared->valid = true;
+}
+
+void ConflictTable::Prepare(const rocksutil::Slice& key,
+    Prepared* prepared) {
+  prepared->hash = HashKey(key);
+  prepared->valid = false;
+  if (cells_ != nullptr && LookupCell(prepared->hash)) {
+    // most likely taken by the single writer filter
+    return;
+  }
+  Shard* shard = &shards_[ShardIndex(prepared->hash)];
+  if (fingerprint_) {
+    PrepareSlot<FingerprintSlot>(shard, key, prepared);
+  } else {
+    PrepareSlot<KeySlot>(shard, key, prepared);
+  }
+}
+
+template <typename Slot>
+bool ConflictTable::UpdateSlot(Shard* shard, uint64_t hash,
+    const rocksutil::Slice& key, int32_t server_id, int32_t exec_time,
+    uint32_t number, const Prepared* prepared) {
+  rocksutil::MutexLock l(&shard->mutex);
+  Floor floor = { false, 0, 0 };
+  bool accepted = false;
+  if (cells_ != nullptr && UpdateCell(shard, hash, server_id, exec_time,
+        number, &floor, &accepted)) {
+    return accepted;
+  }
+  SlotArray* array = shard->array.load(std::memory_order_relaxed);
+  Slot* slots = reinterpret_cast<Slot*>(array->slots);
+  Slot* slot = nullptr;
+  if (prepared != nullptr && prepared->valid) {
+    prepared_++;
+    if (prepared->generation ==
+        shard->generation.load(std::memory_order_relaxed)) {
+      /*
+       *  Entries only move by rebuilds, the key is still in the slot it
+       *  was found in, or was inserted at the empty one or after it
+       */
+      prepared_hits_++;
+      slot = prepared->found ? &slots[prepared->index] :
+        FindSlot(slots, array->capacity, hash, key, prepared->index);
+    } else {
+      prepared = nullptr;
+    }
+  } else {
+    prepared = nullptr;
+  }
+  if (slot == nullptr) {
+    slot = FindSlot(slots, array->capacity, hash, key);
+  }
+  if (!IsEmpty(slot)) {
+    if (exec_time < slot->exec_time ||
+        (exec_time == slot->exec_time && server_id != slot->server_id)) {
+      Reclaim(shard);
+      return false;
+    }
+    BeginWrite(shard);
+    __atomic_store_n(&slot->server_id, server_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->exec_time, exec_time, __ATOMIC_RELAXED);
+    slot->number = std::max(slot->number, number);
+    EndWrite(shard);
+    Reclaim(shard);
+    return true;
+  }
+
+  int32_t spilled_server_id = 0;
+  int32_t spilled_exec_time = 0;
+  bool spilled = false;
+  std::string buf;
+  if (prepared != nullptr) {
+    // the spill tier is only written by a rebuild
+    spilled = prepared->spilled;
+    spilled_server_id = prepared->spilled_server_id;
+    spilled_exec_time = prepared->spilled_exec_time;
+  } else if (spill_ != nullptr && spilled_ > 0) {
+    // nothing to find before the first eviction
+    spilled = spill_->Get(SpillKey(hash, key, &buf),
+        &spilled_server_id, &spilled_exec_time);
+  }
+  if (spilled) {
+    spill_hits_++;
+    if (exec_time < spilled_exec_time ||
+        (exec_time == spilled_exec_time && server_id != spilled_server_id)) {
+      Reclaim(shard);
+      return false;
+    }
+  } else if (floor.has_floor && server_id != floor.server_id &&
+      exec_time <= floor.exec_time) {
+    Reclaim(shard);
+    return false;
+  }
+
+  InsertSlot<Slot>(shard, slot, hash, key, server_id, exec_time, number);
+  Reclaim(shard);
+  return true;
+}
+
+template <typename Slot>
+void ConflictTable::InsertSlot(Shard* shard, Slot* slot, uint64_t hash,
+    const rocksutil::Slice& key, int32_t server_id, int32_t exec_time,
+    uint32_t number) {
+  BeginWrite(shard);
+  // keep the load factor under 3/4, probing stays short
+  SlotArray* array = shard->array.load(std::memory_order_relaxed);
+  if ((shard->size + 1) * 4 > array->capacity * 3) {
+    Rebuild<Slot>(shard, array->capacity * 2, INT32_MIN, 0, false);
+    array = shard->array.load(std::memory_order_relaxed);
+    slot = FindSlot(reinterpret_cast<Slot*>(array->slots),
+        array->capacity, hash, key);
+  }
+  if (slot == nullptr) {
+    // never, the probe only fails on a full array
+    EndWrite(shard);
+    return;
+  }
+  __atomic_store_n(&slot->server_id, server_id, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->exec_time, exec_time, __ATOMIC_RELAXED);
+  slot->number = number;
+  Fill(shard, slot, hash, key);
+  shard->min_number = shard->size == 0 ? number :
+    std::min(shard->min_number, number);
+  shard->size++;
+  EndWrite(shard);
+  if (max_shard_memory_ > 0 && ShardMemory(shard) > max_shard_memory_) {
+    Evict<Slot>(shard);
+  }
+}
+
+template <typename Slot>
+bool ConflictTable::LookupSlot(Shard* shard, uint64_t hash,
+    const rocksutil::Slice& key, int32_t* server_id, int32_t* exec_time) {
+  ReaderSlot* reader = EnterRead();
+  bool found = false;
+  while (true) {
+    uint64_t version = shard->version.load(std::memory_order_acquire);
+    if (version & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    SlotArray* array = shard->array.load();
+    Slot* slot = FindSlot(reinterpret_cast<Slot*>(array->slots),
+        array->capacity, hash, key);
+    found = false;
+    if (slot != nullptr && !IsEmpty(slot)) {
+      found = true;
+      *server_id = __atomic_load_n(&slot->server_id, __ATOMIC_RELAXED);
+      *exec_time = __atomic_load_n(&slot->exec_time, __ATOMIC_RELAXED);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (shard->version.load(std::memory_order_relaxed) == version) {
+      break;
+    }
+  }
+  ExitRead(reader);
+
+  std::string buf;
+  if (!found && spill_ != nullptr && spilled_ > 0 &&
+      spill_->Get(SpillKey(hash, key, &buf), server_id, exec_time)) {
+    spill_hits_++;
+    found = true;
+  }
+  return found;
+}
+
+bool ConflictTable::Update(const rocksutil::Slice& key, int32_t server_id,
+    int32_t exec_time, uint64_t number, const Prepared* prepared) {
+  uint64_t hash = prepared != nullptr ? prepared->hash : HashKey(key);
+  Shard* shard = &shards_[ShardIndex(hash)];
+  updates_.fetch_add(1, std::memory_order_relaxed);
+  uint32_t slot_number = static_cast<uint32_t>(
+      std::min(number, static_cast<uint64_t>(UINT32_MAX)));
+  if (fingerprint_) {
+    return UpdateSlot<FingerprintSlot>(shard, hash, key,
+        server_id, exec_time, slot_number, prepared);
+  }
+  return UpdateSlot<KeySlot>(shard, hash, key, server_id, exec_time,
+      slot_number, prepared);
+}
+
+bool ConflictTable::Lookup(const rocksutil::Slice& key, int32_t* server_id,
+    int32_t* exec_time) {
+  uint64_t hash = HashKey(key);
+  Shard* shard = &shards_[ShardIndex(hash)];
+  lookups_.fetch_add(1, std::memory_order_relaxed);
+  if (cells_ != nullptr && LookupCell(hash)) {
+    // the only writer of the key wrote it, nothing to check
+    lookup_hits_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (fingerprint_) {
+    return LookupSlot<FingerprintSlot>(shard, hash, key,
+        server_id, exec_time);
+  }
+  return LookupSlot<KeySlot>(shard, hash, key, server_id, exec_time);
+}
+
+size_t ConflictTable::Size() {
+  size_t size = 0;
+  for (int i = 0; i < kConflictTableShards; i++) {
+    rocksutil::MutexLock l(&shards_[i].mutex);
+    size += shards_[i].size;
+  }
+  return size;
+}
+
+size_t ConflictTable::MemoryUsage() {
+  size_t usage = 0;
+  for (int i = 0; i < kConflictTableShards; i++) {
+    rocksutil::MutexLock l(&shards_[i].mutex);
+    usage += ShardMemory(&shards_[i]);
+  }
+  return usage + single_writer_cells() * sizeof(uint64_t);
+}
+
+double ConflictTable::ExpectedCollisions() {
+  if (!fingerprint_) {
+    return 0;
+  }
+  // birthday bound of n fingerprints of 64 bits
+  double n = static_cast<double>(Size());
+  return n * n / 36893488147419103232.0;  // 2^65
+}
+
+double ConflictTable::SingleWriterUpdateHitRate() {
+  uint64_t updates = updates_.load(std::memory_order_relaxed);
+  return updates == 0 ? 0 : static_cast<double>(update_hits_) / updates;
+}
+
+double ConflictTable::SingleWriterLookupHitRate() {
+  uint64_t lookups = lookups_.load(std::memory_order_relaxed);
+  return lookups == 0 ? 0 : static_cast<double>(lookup_hits_) / lookups;
+}
+
+double ConflictTable::PreparedHitRate() {
+  uint64_t prepared = prepared_.load(std::memory_order_relaxed);
+  return prepared == 0 ? 0 : static_cast<double>(prepared_hits_) / prepared;
+}
+
+/*
+ *  Shard i is encoded as Fixed32 i, Varint64 entry count, then every
+ *  entry: the length prefixed key or the Fixed64 fingerprint, Fixed32
+ *  server_id, exec_time and number, then Varint64 count of used cells,
+ *  each as Varint64 index in the shard and Fixed64 value, a contended
+ *  one followed by the Varint32 binlog number it became contended in
+ */
+template <typename Slot>
+void ConflictTable::EncodeSlots(Shard* shard, std::string* dst) {
+  SlotArray* array = shard->array.load(std::memory_order_relaxed);
+  Slot* slots = reinterpret_cast<Slot*>(array->slots);
+  rocksutil::PutVarint64(dst, shard->size);
+  for (size_t j = 0; j < array->capacity; j++) {
+    if (IsEmpty(&slots[j])) {
+      continue;
+    }
+    EncodeKey(&slots[j], dst);
+    rocksutil::PutFixed32(dst, slots[j].server_id);
+    rocksutil::PutFixed32(dst, slots[j].exec_time);
+    rocksutil::PutFixed32(dst, slots[j].number);
+  }
+}
+
+void ConflictTable::EncodeShard(int i, std::string* dst) {
+  Shard* shard = &shards_[i];
+  rocksutil::MutexLock l(&shard->mutex);
+  rocksutil::PutFixed32(dst, i);
+  if (fingerprint_) {
+    EncodeSlots<FingerprintSlot>(shard, dst);
+  } else {
+    EncodeSlots<KeySlot>(shard, dst);
+  }
+
+  size_t shard_cells = single_writer_cells() / kConflictTableShards;
+  std::atomic<uint64_t>* cells = cells_ + i * shard_cells;
+  uint64_t used = 0;
+  for (size_t j = 0; j < shard_cells; j++) {
+    if (cells[j].load(std::memory_order_relaxed) != 0) {
+      used++;
+    }
+  }
+  rocksutil::PutVarint64(dst, used);
+  for (size_t j = 0; used > 0 && j < shard_cells; j++) {
+    uint64_t value = cells[j].load(std::memory_order_relaxed);
+    if (value != 0) {
+      rocksutil::PutVarint64(dst, j);
+      rocksutil::PutFixed64(dst, value);
+      if ((value >> 32) & kContended) {
+        rocksutil::PutVarint32(dst, shard->contended[i * shard_cells + j]);
+      }
+    }
+  }
+}
+
+template <typename Slot>
+bool ConflictTable::DecodeSlots(Shard* shard, int i,
+    rocksutil::Slice* input) {
+  uint64_t size = 0;
+  if (!rocksutil::GetVarint64(input, &size)) {
+    return false;
+  }
+  rocksutil::Slice key;
+  uint64_t hash = 0;
+  uint32_t server_id, exec_time, number;
+  for (uint64_t n = 0; n < size; n++) {
+    if (fingerprint_) {
+      if (!rocksutil::GetFixed64(input, &hash)) {
+        return false;
+      }
+    } else {
+      if (!rocksutil::GetLengthPrefixedSlice(input, &key)) {
+        return false;
+      }
+      hash = HashKey(key);
+    }
+    if (ShardIndex(hash) != i ||
+        !rocksutil::GetFixed32(input, &server_id) ||
+        !rocksutil::GetFixed32(input, &exec_time) ||
+        !rocksutil::GetFixed32(input, &number)) {
+      return false;
+    }
+    SlotArray* array = shard->array.load(std::memory_order_relaxed);
+    Slot* slot = FindSlot(reinterpret_cast<Slot*>(array->slots),
+        array->capacity, hash, key);
+    if (IsEmpty(slot)) {
+      InsertSlot<Slot>(shard, slot, hash, key,
+          static_cast<int32_t>(server_id), static_cast<int32_t>(exec_time),
+          number);
+    }
+  }
+  return true;
+}
+
+bool ConflictTable::DecodeShard(const rocksutil::Slice& rep) {
+  rocksutil::Slice input(rep);
+  uint32_t i = 0;
+  if (!rocksutil::GetFixed32(&input, &i) ||
+      i >= static_cast<uint32_t>(kConflictTableShards)) {
+    return false;
+  }
+  Shard* shard = &shards_[i];
+  rocksutil::MutexLock l(&shard->mutex);
+  bool ok = fingerprint_ ?
+    DecodeSlots<FingerprintSlot>(shard, i, &input) :
+    DecodeSlots<KeySlot>(shard, i, &input);
+  uint64_t used = 0;
+  if (!ok || !rocksutil::GetVarint64(&input, &used)) {
+    Reclaim(shard);
+    return false;
+  }
+
+  size_t shard_cells = single_writer_cells() / kConflictTableShards;
+  std::atomic<uint64_t>* cells = cells_ + i * shard_cells;
+  uint64_t j = 0;
+  uint64_t value = 0;
+  uint32_t number = 0;
+  for (uint64_t n = 0; n < used; n++) {
+    if (!rocksutil::GetVarint64(&input, &j) || j >= shard_cells ||
+        !rocksutil::GetFixed64(&input, &value)) {
+      Reclaim(shard);
+      return false;
+    }
+    if ((value >> 32) & kContended) {
+      if (!rocksutil::GetVarint32(&input, &number)) {
+        Reclaim(shard);
+        return false;
+      }
+      if (cells[j].load(std::memory_order_relaxed) == 0) {
+        contended_cells_++;
+      }
+      shard->contended[i * shard_cells + j] = number;
+    }
+    cells[j].store(value, std::memory_order_release);
+  }
+  Reclaim(shard);
+  return true;
+}
@@ -0,0 +1,433 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_PIKA_HUB_CONFLICT_TABLE_H_
+#define SRC_PIKA_HUB_CONFLICT_TABLE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_conflict_spill.h"
+#include "rocksutil/mutexlock.h"
+#include "rocksutil/slice.h"
+#include "rocksutil/coding.h"
+
+/*
+ *  The (server_id, exec_time) of the newest write of every key, used to
+ *  resolve the conflicts between pikas writing the same key.
+ *
+ *  Keys are hashed into kConflictTableShards shards, each is an open
+ *  addressing table with linear probing. Metadata is stored inline in
+ *  the slots, keys are copied into slabs owned by the shard, so an
+ *  entry costs one slot plus the key bytes, no allocation per insert.
+ *  Slabs and slots may be backed by transparent huge pages.
+ *
+ *  With conflict_fingerprint, keys are not stored at all, a slot holds
+ *  the 64-bit hash of the key as its fingerprint and the metadata, 24
+ *  bytes per entry. Two keys with the same fingerprint share an entry:
+ *  a write may then be dropped as older than the other key's newest
+ *  write, and a sender may skip a record for the same reason. With n
+ *  keys about n * n / 2^65 pairs collide, see ExpectedCollisions, e.g.
+ *  0.0003 for 100 million keys, tools/fingerprint_stress checks it.
+ *
+ *  Every entry remembers the binlog file its newest write went to. No
+ *  sender needs an entry once they all read past that file, Collect
+ *  drops such entries, so they are freed before the budget evicts any.
+ *
+ *  Memory is charged in bytes of slot arrays and key slabs. Once a
+ *  shard takes more than its part of conflict_max_memory, it first drops
+ *  the entries below the limit of the last Collect, which no sender
+ *  needs any more. If it is still over its budget, with a spill tier
+ *  opened, the oldest quarter of its entries by exec_time is written to
+ *  it and evicted, and the shard is rebuilt with its keys compacted.
+ *  Update and Lookup fall back to the spill tier on a miss in memory,
+ *  see ConflictSpill. Entries are only evicted once the spill write
+ *  succeeded. Without a spill tier nothing else is evicted, the shard
+ *  stays over its budget and over_budget counts it: a write of an
+ *  evicted key could no longer be told from a late one.
+ *
+ *  Most keys are only written by one pika. With the single writer
+ *  filter, the top bits of the hash pick a cell of 8 bytes holding the
+ *  only server_id which wrote it, a 16-bit fingerprint of the only key
+ *  written and its newest exec_time. While a cell has one writer and
+ *  one key, Update accepts its writes without storing them unless they
+ *  are older than its newest, as the table would, and Lookup reports a
+ *  miss, so senders send them. A write from a second server or of a
+ *  second key marks the cell contended, its keys go through the table
+ *  from then on. A key missing from the table with the fingerprint of
+ *  the cell is checked against the newest write of the former writer,
+ *  which may be its own, other keys have no floor. So only one in 65536
+ *  of the keys sharing a cell may be dropped for the former key's newer
+ *  write. Once Collect passed the binlog file the cell became contended
+ *  in, and no entry of its keys is left in memory or in the spill tier,
+ *  the cell is free again for the next single writer.
+ *
+ *  Update is serialized per shard by a mutex, Lookup never locks: it is
+ *  a seqlock reader of the shard version, which writers make odd while
+ *  they modify the shard, and retries if the version moved. Slot arrays
+ *  and slabs replaced by a rebuild are retired at the current epoch.
+ *  A reader announces the epoch it started at in a reader slot of its
+ *  own thread, no counter is shared by all, and retired memory is freed
+ *  once every reader still in started after its retirement, so a racing
+ *  reader never touches freed memory. Retired memory is charged to the
+ *  shard until it is freed.
+ */
+class ConflictTable {
+ public:
+  explicit ConflictTable(const BinlogOptions& options);
+  ~ConflictTable();
+
+  // Spill evicted entries to a RocksDB in path, which is reset
+  rocksdb::Status OpenSpill(const std::string& path);
+
+  /*
+   *  Where a key is, or goes, in the table, found by Prepare without
+   *  the shard mutex. It holds as long as the shard is not rebuilt,
+   *  which Update checks by generation before using it
+   */
+  struct Prepared {
+    uint64_t hash;
+    bool valid;
+    uint64_t generation;
+    // of the key's slot, or of the empty slot it goes to
+    size_t index;
+    bool found;
+    // the spilled entry of a key not found in memory
+    bool spilled;
+    int32_t spilled_server_id;
+    int32_t spilled_exec_time;
+  };
+
+  /*
+   *  Hash and probe key, and look it up in the spill tier, so Update
+   *  only confirms the result. Called by each writer thread before it
+   *  joins its group, the leader then applies the whole group serially
+   */
+  void Prepare(const rocksutil::Slice& key, Prepared* prepared);
+
+  /*
+   *  Apply the conflict rule to key: a write wins if it is newer, or
+   *  as new but from the same server_id. Record it with the binlog file
+   *  number it goes to and return true if it wins, otherwise return
+   *  false and the write should be dropped
+   */
+  bool Update(const rocksutil::Slice& key, int32_t server_id,
+      int32_t exec_time, uint64_t number,
+      const Prepared* prepared = nullptr);
+  // Return false if key is not in the table
+  bool Lookup(const rocksutil::Slice& key, int32_t* server_id,
+      int32_t* exec_time);
+
+  /*
+   *  Drop the entries last written to binlog files below limit, and
+   *  those below it a shard over its budget meets until the next call
+   */
+  void Collect(uint64_t limit);
+  /*
+   *  Drop every entry, cell and spilled entry, no Update or Lookup may
+   *  run meanwhile. The spill tier is closed if it can not be cleared
+   */
+  void Reset();
+
+  size_t Size();
+  // bytes charged to the table, and those waiting to be reclaimed
+  size_t MemoryUsage();
+  size_t max_memory() const {
+    return max_memory_;
+  }
+  uint64_t evictions() const {
+    return evictions_;
+  }
+  uint64_t collected() const {
+    return collected_;
+  }
+  bool spill_enabled() const {
+    return spill_ != nullptr;
+  }
+  uint64_t spilled() const {
+    return spilled_;
+  }
+  uint64_t spill_hits() const {
+    return spill_hits_;
+  }
+  // failed spill writes, their entries stay in memory over the budget
+  uint64_t spill_errors() const {
+    return spill_errors_;
+  }
+  // inserts leaving a shard over its budget with nothing to evict
+  uint64_t over_budget() const {
+    return over_budget_;
+  }
+  bool fingerprint() const {
+    return fingerprint_;
+  }
+  // Expected number of colliding key pairs, 0 if keys are stored
+  double ExpectedCollisions();
+  size_t single_writer_cells() const {
+    return cells_ != nullptr ? static_cast<size_t>(1) << cell_bits_ : 0;
+  }
+  uint64_t contended_cells() const {
+    return contended_cells_;
+  }
+  // Share of Updates and Lookups done by the single writer filter
+  double SingleWriterUpdateHitRate();
+  double SingleWriterLookupHitRate();
+  // Share of prepared Updates whose shard was not rebuilt meanwhile
+  double PreparedHitRate();
+
+  static uint64_t HashKey(const rocksutil::Slice& key);
+  static int ShardIndex(uint64_t hash) {
+    return static_cast<int>(hash >> (64 - kConflictTableShardBits));
+  }
+  int32_t single_writer_bits() const {
+    return cells_ != nullptr ? cell_bits_ : 0;
+  }
+
+  /*
+   *  Append the entries and single writer cells of shard i to dst, the
+   *  shard is locked meanwhile, see BinlogManager::SnapshotConflictTable
+   */
+  void EncodeShard(int i, std::string* dst);
+  // Load a shard encoded by EncodeShard, return false if it is corrupted
+  bool DecodeShard(const rocksutil::Slice& rep);
+
+ private:
+  /*
+   *  key is published last with release, so hash and key_size are valid
+   *  once a reader sees it, they never change afterwards
+   */
+  struct KeySlot {
+    uint64_t hash;
+    const char* key;  // nullptr if empty
+    uint32_t key_size;
+    int32_t server_id;
+    int32_t exec_time;
+    uint32_t number;
+  };
+
+  // fingerprint is published last with release, 0 if empty
+  struct FingerprintSlot {
+    uint64_t fingerprint;
+    int32_t server_id;
+    int32_t exec_time;
+    uint32_t number;
+  };
+
+  // KeySlot or FingerprintSlot array, replaced as a whole
+  struct SlotArray {
+    size_t capacity;
+    char* slots;
+  };
+
+  // an array or a slab replaced at epoch, the other one is nullptr
+  struct Retired {
+    uint64_t epoch;
+    SlotArray* array;
+    char* slab;
+    size_t bytes;
+  };
+
+  /*
+   *  The epoch a reader entered at, 0 if free, alone in its cache line
+   *  so the readers of different threads do not share one
+   */
+  struct ReaderSlot {
+    std::atomic<uint64_t> epoch;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  struct Shard {
+    rocksutil::port::Mutex mutex;
+    std::atomic<uint64_t> version;  // odd while being modified
+    std::atomic<SlotArray*> array;
+    // bumped by every rebuild, see Prepared
+    std::atomic<uint64_t> generation;
+    size_t size;
+    // no entry is in a binlog file below it
+    uint32_t min_number;
+    // newest binlog file of the entries spilled from the shard
+    uint32_t spilled_number;
+    /*
+     *  the binlog file of the write which made each contended cell of
+     *  the shard contended, by cell index, its floor is not newer
+     */
+    std::unordered_map<size_t, uint32_t> contended;
+    // key slabs
+    std::vector<std::pair<char*, size_t> > slabs;
+    size_t slab_bytes;
+    char* alloc_ptr;
+    size_t alloc_remaining;
+    // arrays and slabs replaced by a rebuild, see Reclaim
+    std::vector<Retired> retired;
+    size_t retired_bytes;
+    Shard() : version(0), array(nullptr), generation(0), size(0),
+      min_number(0), spilled_number(0), slab_bytes(0), alloc_ptr(nullptr),
+      alloc_remaining(0), retired_bytes(0) {}
+  };
+
+  bool huge_page_;
+  bool fingerprint_;
+  size_t slot_size_;
+  size_t max_memory_;
+  // budget of a shard, 0 means no limit
+  size_t max_shard_memory_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> collected_;
+  std::atomic<uint64_t> over_budget_;
+  // limit of the last Collect
+  std::atomic<uint32_t> collect_limit_;
+  ConflictSpill* spill_;
+  std::atomic<uint64_t> spilled_;
+  std::atomic<uint64_t> spill_hits_;
+  std::atomic<uint64_t> spill_errors_;
+  Shard* shards_;
+  // bumped by every retirement, starts at 1
+  std::atomic<uint64_t> epoch_;
+  ReaderSlot* reader_slots_;
+  // single writer filter, nullptr if disabled
+  std::atomic<uint64_t>* cells_;
+  int32_t cell_bits_;
+  std::atomic<uint64_t> contended_cells_;
+  std::atomic<uint64_t> updates_;
+  std::atomic<uint64_t> update_hits_;
+  std::atomic<uint64_t> lookups_;
+  std::atomic<uint64_t> lookup_hits_;
+  std::atomic<uint64_t> prepared_;
+  std::atomic<uint64_t> prepared_hits_;
+
+  /*
+   *  A key missing from the table is checked against floor, the newest
+   *  write of the former single writer of its cell, if has_floor, i.e.
+   *  the key has the fingerprint of the one the writer wrote
+   */
+  struct Floor {
+    bool has_floor;
+    int32_t server_id;
+    int32_t exec_time;
+  };
+
+  /*
+   *  Return true if the single writer filter decides the write, which
+   *  is accepted if *accepted is true, with the shard mutex held
+   */
+  bool UpdateCell(Shard* shard, uint64_t hash, int32_t server_id,
+      int32_t exec_time, uint32_t number, Floor* floor, bool* accepted);
+  bool LookupCell(uint64_t hash);
+  template <typename Slot>
+  void PrepareSlot(Shard* shard, const rocksutil::Slice& key,
+      Prepared* prepared);
+  /*
+   *  Insert key at the empty slot, with the shard mutex held, then evict
+   *  if the shard is over its budget
+   */
+  template <typename Slot>
+  void InsertSlot(Shard* shard, Slot* slot, uint64_t hash,
+      const rocksutil::Slice& key, int32_t server_id, int32_t exec_time,
+      uint32_t number);
+  template <typename Slot>
+  void EncodeSlots(Shard* shard, std::string* dst);
+  template <typename Slot>
+  bool DecodeSlots(Shard* shard, int i, rocksutil::Slice* input);
+  template <typename Slot>
+  bool UpdateSlot(Shard* shard, uint64_t hash, const rocksutil::Slice& key,
+      int32_t server_id, int32_t exec_time, uint32_t number,
+      const Prepared* prepared);
+  template <typename Slot>
+  bool LookupSlot(Shard* shard, uint64_t hash, const rocksutil::Slice& key,
+      int32_t* server_id, int32_t* exec_time);
+  /*
+   *  Replace the slots of shard with an array of capacity, or one sized
+   *  for the entries left if 0, entries older than evict_before or in
+   *  binlog files below collect_before are dropped. With compact, live
+   *  keys are copied into a new slab and the old slabs are retired
+   */
+  template <typename Slot>
+  void Rebuild(Shard* shard, size_t capacity, int32_t evict_before,
+      uint32_t collect_before, bool compact);
+  template <typename Slot>
+  void Evict(Shard* shard);
+  template <typename Slot>
+  void CollectShard(Shard* shard, uint32_t limit);
+  // Free the contended cells of shard whose keys are all collected
+  template <typename Slot>
+  void ReleaseCells(Shard* shard, uint32_t limit);
+  static size_t CapacityFor(size_t size);
+
+  // Probe from the home slot of hash, or from slot index if given
+  static KeySlot* FindSlot(KeySlot* slots, size_t capacity, uint64_t hash,
+      const rocksutil::Slice& key, size_t index = SIZE_MAX);
+  static FingerprintSlot* FindSlot(FingerprintSlot* slots, size_t capacity,
+      uint64_t hash, const rocksutil::Slice& key, size_t index = SIZE_MAX);
+  static bool IsEmpty(const KeySlot* slot);
+  static bool IsEmpty(const FingerprintSlot* slot);
+  void Fill(Shard* shard, KeySlot* slot, uint64_t hash,
+      const rocksutil::Slice& key);
+  void Fill(Shard* shard, FingerprintSlot* slot, uint64_t hash,
+      const rocksutil::Slice& key);
+  static uint64_t SlotHash(const KeySlot* slot) {
+    return slot->hash;
+  }
+  static uint64_t SlotHash(const FingerprintSlot* slot) {
+    return slot->fingerprint;
+  }
+  static size_t KeySize(const KeySlot* slot) {
+    return slot->key_size;
+  }
+  static size_t KeySize(const FingerprintSlot* slot) {
+    return 0;
+  }
+  static void MoveKey(KeySlot* slot, char* dst) {
+    memcpy(dst, slot->key, slot->key_size);
+    slot->key = dst;
+  }
+  static void MoveKey(FingerprintSlot* slot, char* dst) {}
+  static void EncodeKey(const KeySlot* slot, std::string* dst) {
+    rocksutil::PutLengthPrefixedSlice(dst,
+        rocksutil::Slice(slot->key, slot->key_size));
+  }
+  static void EncodeKey(const FingerprintSlot* slot, std::string* dst) {
+    rocksutil::PutFixed64(dst, slot->fingerprint);
+  }
+  static rocksdb::Slice SpillKey(const KeySlot* slot, std::string* buf) {
+    return rocksdb::Slice(slot->key, slot->key_size);
+  }
+  static rocksdb::Slice SpillKey(const FingerprintSlot* slot,
+      std::string* buf);
+  rocksdb::Slice SpillKey(uint64_t hash, const rocksutil::Slice& key,
+      std::string* buf);
+  template <typename Slot>
+  bool Spill(Shard* shard, int32_t evict_before);
+  static void BeginWrite(Shard* shard);
+  static void EndWrite(Shard* shard);
+  // bytes charged to shard, the retired ones included
+  size_t ShardMemory(Shard* shard);
+  // Claim a reader slot with the current epoch, before reading a shard
+  ReaderSlot* EnterRead();
+  static void ExitRead(ReaderSlot* slot);
+  /*
+   *  Retire array, replaced in shard after the new one was stored, and
+   *  the key slabs of shard if slabs
+   */
+  void Retire(Shard* shard, SlotArray* array, bool slabs);
+  // Free the retired memory no reader may still be in
+  void Reclaim(Shard* shard);
+  const char* CopyKey(Shard* shard, const rocksutil::Slice& key);
+  char* Allocate(size_t bytes);
+  void Deallocate(char* ptr, size_t bytes);
+  SlotArray* NewSlotArray(size_t capacity);
+  void DeleteSlotArray(SlotArray* array);
+
+  // No copying allowed
+  ConflictTable(const ConflictTable&);
+  void operator=(const ConflictTable&);
+};
+
+#endif  // SRC_PIKA_HUB_CONFLICT_TABLE_H_
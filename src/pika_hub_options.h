@@ -9,6 +9,7 @@
 #include <memory>
 #include <string>
 
+#include "src/pika_hub_common.h"
 #include "rocksutil/auto_roll_logger.h"
 #include "floyd/include/floyd.h"
 
@@ -21,6 +22,7 @@ struct PikaHubOptions {
   size_t log_file_time_to_roll = 0;
   rocksutil::InfoLogLevel info_log_level = rocksutil::INFO_LEVEL;
   std::string pika_servers = "127.0.0.1:9221";
+  BinlogOptions binlog_options;
 
   rocksutil::Env* env = rocksutil::Env::Default();
 };
@@ -37,6 +39,54 @@ struct Options : public PikaHubOptions, public floyd::Options {
     Header(log, " log_file_time_to_roll = %u", log_file_time_to_roll);
     Header(log, " info_log_level = %d", info_log_level);
     Header(log, " pika_servers = %s", pika_servers.c_str());
+    Header(log, " binlog_group_max_records = %d",
+        binlog_options.group_max_records);
+    Header(log, " binlog_group_max_bytes = %d",
+        binlog_options.group_max_bytes);
+    Header(log, " binlog_group_linger_us = %d",
+        binlog_options.group_linger_us);
+    Header(log, " binlog_pipeline_write = %d",
+        binlog_options.pipeline_write);
+    Header(log, " binlog_file_size = %d",
+        binlog_options.file_size);
+    Header(log, " binlog_sync_mode = %d",
+        binlog_options.sync_mode);
+    Header(log, " binlog_sync_interval_ms = %d",
+        binlog_options.sync_interval_ms);
+    Header(log, " binlog_sync_bytes = %d",
+        binlog_options.sync_bytes);
+    Header(log, " binlog_compression = %d",
+        binlog_options.compression);
+    Header(log, " binlog_compression_min_bytes = %d",
+        binlog_options.compression_min_bytes);
+    Header(log, " binlog_entry_version = %d",
+        binlog_options.entry_version);
+    Header(log, " binlog_expire_files = %d",
+        binlog_options.expire_files);
+    Header(log, " binlog_expire_seconds = %d",
+        binlog_options.expire_seconds);
+    Header(log, " binlog_max_total_size = %ld",
+        binlog_options.max_total_size);
+    Header(log, " binlog_archive_path = %s",
+        binlog_options.archive_path.c_str());
+    Header(log, " binlog_tail_cache_size = %ld",
+        binlog_options.tail_cache_size);
+    Header(log, " binlog_dispatch_queue_size = %d",
+        binlog_options.dispatch_queue_size);
+    Header(log, " conflict_huge_page = %d",
+        binlog_options.conflict_huge_page);
+    Header(log, " conflict_fingerprint = %d",
+        binlog_options.conflict_fingerprint);
+    Header(log, " conflict_max_memory = %ld",
+        binlog_options.conflict_max_memory);
+    Header(log, " conflict_spill_path = %s",
+        binlog_options.conflict_spill_path.c_str());
+    Header(log, " conflict_single_writer_bits = %d",
+        binlog_options.conflict_single_writer_bits);
+    Header(log, " conflict_snapshot_path = %s",
+        binlog_options.conflict_snapshot_path.c_str());
+    Header(log, " conflict_snapshot_interval = %d",
+        binlog_options.conflict_snapshot_interval);
     Header(log, "");
     Header(log, "Floyd:");
     Header(log, " members = %s", str_members.c_str());
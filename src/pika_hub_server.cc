@@ -100,7 +100,7 @@ PikaHubServer::PikaHubServer(const Options& options)
                   inner_conn_factory_, 1000, 1000, inner_server_handler_);
   inner_server_thread_->set_keepalive_timeout(0);
   binlog_manager_ = CreateBinlogManager(options.info_log_path, options.env,
-                      options_.info_log);
+                      options_.info_log, options_.binlog_options);
 }
 
 PikaHubServer::~PikaHubServer() {
@@ -300,10 +300,26 @@ slash::Status PikaHubServer::Start() {
           success = false;
         }
       }
+      EncodeSendOffset(&value, self);
+      floyd_status = floyd_->Write(kSendOffsetKey, value);
+      if (!floyd_status.ok()) {
+        rocksutil::Warn(options_.info_log,
+            "Write send offset to floyd failed %s",
+            floyd_status.ToString().c_str());
+        success = false;
+      }
       if (success) {
         last_success_save_offset_time_ = std::chrono::system_clock::now();
       }
       floyd_->UnLock(kLockName, self);
+
+      /*
+       *  7. purge the binlogs and the conflict entries all senders have
+       *  gone past
+       */
+      uint64_t purged = 0;
+      PurgeBinlogs(UINT64_MAX, &purged);
+      binlog_manager_->CollectConflictTable(SendWatermark());
     }
   }
   delete this;
@@ -351,6 +367,22 @@ void PikaHubServer::ResetRcvFd(int fd, const std::string& ip_port) {
   }
 }
 
+static const char* SyncStatusName(SyncStatus status) {
+  switch (status) {
+    case kShouldConnect:
+      return "should_connect";
+    case kConnected:
+      return "connected";
+    case kErrorHappened:
+      return "error_happened";
+    case kShouldDelete:
+      return "should_delete";
+    case kNeedFullSync:
+      return "need_full_sync";
+  }
+  return "unknown";
+}
+
 std::string PikaHubServer::DumpPikaServers() {
   rocksutil::MutexLock l(&pika_mutex_);
   std::string res;
@@ -359,7 +391,7 @@ std::string PikaHubServer::DumpPikaServers() {
         ", ip:" + iter->second.ip +
         ", port:" + std::to_string(iter->second.port) +
         ", password:" + iter->second.passwd +
-        ", sync_status:" + std::to_string(iter->second.sync_status) +
+        ", sync_status:" + SyncStatusName(iter->second.sync_status) +
         ", receive_fd_num:" + std::to_string(iter->second.rcv_fd_num) +
         ", recv_offset:" + std::to_string(iter->second.rcv_number) +
         ":" + std::to_string(iter->second.rcv_offset) +
@@ -400,9 +432,65 @@ void PikaHubServer::UpdateRcvOffset(int32_t server_id,
 
 void PikaHubServer::GetBinlogWriterOffset(uint64_t* number,
     uint64_t* offset) {
+  // the writer rolls files under the manager mutex, not pika_mutex_
+  rocksutil::MutexLock l(binlog_manager_->mutex());
+  binlog_manager_->GetWriterOffset(number, offset);
+}
+
+void PikaHubServer::GetGroupCommitStats(GroupCommitStats* stats) {
+  rocksutil::MutexLock l(&pika_mutex_);
+  if (binlog_writer_ != nullptr) {
+    binlog_writer_->GetGroupCommitStats(stats);
+  }
+}
+
+void PikaHubServer::GetRollStats(RollStats* stats) {
+  rocksutil::MutexLock l(&pika_mutex_);
+  if (binlog_writer_ != nullptr) {
+    binlog_writer_->GetRollStats(stats);
+  }
+}
+
+void PikaHubServer::GetSyncStats(SyncStats* stats) {
+  rocksutil::MutexLock l(&pika_mutex_);
+  stats->mode = options_.binlog_options.sync_mode;
+  if (binlog_writer_ != nullptr) {
+    binlog_writer_->GetSyncStats(stats);
+  }
+}
+
+uint64_t PikaHubServer::SendWatermark() {
+  uint64_t watermark = UINT64_MAX;
+  uint64_t retention_limit = binlog_manager_->RetentionLimit();
   rocksutil::MutexLock l(&pika_mutex_);
-  *number = binlog_writer_->number();
-  *offset = binlog_writer_->GetOffsetInFile();
+  for (auto iter = pika_servers_.begin(); iter != pika_servers_.end();
+      iter++) {
+    if (iter->second.sync_status == kNeedFullSync) {
+      // reads no binlog until it is full synced
+      continue;
+    }
+    /*
+     *  A pika connected or not counts, since a sender resumes from
+     *  send_number:send_offset whenever it reconnects, unless it has been
+     *  away for longer than the binlogs are retained
+     */
+    if (iter->second.sync_status != kConnected &&
+        iter->second.send_number < retention_limit) {
+      rocksutil::Warn(options_.info_log, "Pika %d at binlog %lu is out of "
+          "retention, binlogs below %lu are purged, it needs a full sync",
+          iter->first, iter->second.send_number, retention_limit);
+      iter->second.sync_status = kNeedFullSync;
+      continue;
+    }
+    watermark = std::min(watermark, iter->second.send_number);
+  }
+  return watermark;
+}
+
+rocksutil::Status PikaHubServer::PurgeBinlogs(uint64_t limit,
+    uint64_t* purged) {
+  return binlog_manager_->PurgeBinlogs(std::min(limit, SendWatermark()),
+      purged);
 }
 
 void PikaHubServer::DisconnectPika(int32_t server_id, bool reconnect) {
@@ -440,7 +528,8 @@ void PikaHubServer::DisconnectPika(int32_t server_id, bool reconnect) {
     iter->second.sender = nullptr;
     iter->second.hb_fd = -1;
     iter->second.heartbeat = nullptr;
-    if (reconnect) {
+    // its binlogs are gone, reconnecting would fail again
+    if (reconnect && iter->second.sync_status != kNeedFullSync) {
       iter->second.sync_status = kShouldConnect;
     }
   }
@@ -687,6 +776,95 @@ void PikaHubServer::DecodeOffset(const std::string& value,
   *rcv_offset = 0;
 }
 
+void PikaHubServer::EncodeSendOffset(std::string* value,
+    const std::string& holder) {
+  value->clear();
+  rocksutil::MutexLock l(&pika_mutex_);
+  rocksutil::PutFixed32(value, pika_servers_.size());
+  for (auto iter = pika_servers_.begin(); iter != pika_servers_.end();
+      iter++) {
+    rocksutil::PutFixed32(value, iter->first);
+    rocksutil::PutFixed64(value, iter->second.send_number);
+  }
+  value->append(holder);
+}
+
+bool PikaHubServer::DecodeSendOffset(const std::string& value,
+    std::string* holder, std::map<int32_t, uint64_t>* send_numbers) {
+  if (value.size() < 4) {
+    return false;
+  }
+  size_t pos = 0;
+  uint32_t num = rocksutil::DecodeFixed32(value.data() + pos);
+  pos += 4;
+  if (value.size() < pos + num * 12) {
+    return false;
+  }
+  for (uint32_t i = 0; i < num; i++) {
+    int32_t server_id = rocksutil::DecodeFixed32(value.data() + pos);
+    pos += 4;
+    (*send_numbers)[server_id] = rocksutil::DecodeFixed64(value.data() + pos);
+    pos += 8;
+  }
+  holder->assign(value.data() + pos, value.size() - pos);
+  return true;
+}
+
+/*
+ *  Resume the local binlogs if this pika_hub was the last primary, which
+ *  saved the send offsets of its senders, otherwise the binlogs are
+ *  stale and reset. Return true if resumed
+ */
+bool PikaHubServer::RecoverBinlog() {
+  std::string self = options_.local_ip + ":" +
+    std::to_string(options_.port);
+  std::string value;
+  std::string holder;
+  std::map<int32_t, uint64_t> send_numbers;
+  slash::Status s = floyd_->Read(kSendOffsetKey, &value);
+  if (s.ok()) {
+    if (!DecodeSendOffset(value, &holder, &send_numbers)) {
+      rocksutil::Warn(options_.info_log, "RecoverBinlog, bad send offset");
+    }
+  } else if (!s.IsNotFound()) {
+    rocksutil::Warn(options_.info_log, "RecoverBinlog, read floyd error: %s",
+        s.ToString().c_str());
+  }
+
+  if (holder != self) {
+    rocksutil::Info(options_.info_log,
+        "RecoverBinlog, last primary is %s, reset binlog",
+        holder.empty() ? "NULL" : holder.c_str());
+    binlog_manager_->ResetOffsetAndBinlog();
+    return false;
+  }
+
+  rocksutil::Status rs = binlog_manager_->Recover();
+  int64_t nums = 0;
+  if (rs.ok()) {
+    rs = binlog_manager_->RecoverConflictTable(&nums);
+  }
+  if (!rs.ok()) {
+    rocksutil::Warn(options_.info_log, "RecoverBinlog failed: %s, "
+        "reset binlog", rs.ToString().c_str());
+    binlog_manager_->ResetOffsetAndBinlog();
+    return false;
+  }
+
+  rocksutil::MutexLock l(&pika_mutex_);
+  for (auto iter = pika_servers_.begin(); iter != pika_servers_.end();
+      iter++) {
+    auto it = send_numbers.find(iter->first);
+    iter->second.send_number = it != send_numbers.end() ? it->second : 0;
+    iter->second.send_offset = 0;
+    rocksutil::Info(options_.info_log, "RecoverBinlog, server %d send from "
+        "binlog %lu", iter->first, iter->second.send_number);
+  }
+  rocksutil::Info(options_.info_log, "RecoverBinlog, %ld entries recovered "
+      "into conflict table", nums);
+  return true;
+}
+
 slash::Status PikaHubServer::BecomePrimary() {
   rocksutil::Info(options_.info_log, "BecomePrimary start");
   rocksutil::Info(options_.info_log, "BecomePrimary-1: set primary identify");
@@ -700,27 +878,36 @@ slash::Status PikaHubServer::BecomePrimary() {
   }
 
   rocksutil::Info(options_.info_log,
-      "BecomePrimary-3: create new binlog_writer");
+      "BecomePrimary-3: recover binlog");
+  bool resumed = RecoverBinlog();
+
+  rocksutil::Info(options_.info_log,
+      "BecomePrimary-4: create new binlog_writer");
   binlog_writer_ = binlog_manager_->AddWriter();
+  if (binlog_manager_->StartDispatcher() != 0) {
+    rocksutil::Warn(options_.info_log, "BecomePrimary-4: start binlog "
+        "dispatcher error, senders read the binlogs themselves");
+  }
 
   rocksutil::Info(options_.info_log,
-      "BecomePrimary-4: start inner_server thread");
+      "BecomePrimary-5: start inner_server thread");
   int ret = inner_server_thread_->StartThread();
   if (ret != 0) {
     rocksutil::Error(options_.info_log,
-        "BecomePrimary-4: start inner_server thread error");
+        "BecomePrimary-5: start inner_server thread error");
     return slash::Status::Corruption("Start inner_server error");
   }
 
   rocksutil::Info(options_.info_log,
-      "BecomePrimary-5: create & start trysync thread");
+      "BecomePrimary-6: create & start trysync thread");
   trysync_thread_ = new PikaHubTrysync(options_.info_log, options_.local_ip,
       options_.port, &pika_servers_, &pika_mutex_, &recover_offset_,
-      binlog_manager_);
+      binlog_manager_,
+      resumed ? kResumeRecvRollbackNums : kMaxRecvRollbackNums);
   ret = trysync_thread_->StartThread();
   if (ret != 0) {
     rocksutil::Error(options_.info_log,
-        "BecomePrimary-5: start trysync thread error");
+        "BecomePrimary-6: start trysync thread error");
     return slash::Status::Corruption("Start trysync thread error");
   }
 
@@ -741,6 +928,8 @@ void PikaHubServer::BecomeSecondary() {
       "BecomeSecondary-2: delete trysync thread");
   delete trysync_thread_;
   trysync_thread_ = nullptr;
+  // no sender is left
+  binlog_manager_->StopDispatcher();
   rocksutil::Info(options_.info_log,
       "BecomeSecondary-3: reset pika_servers offset");
   {
@@ -767,9 +956,12 @@ void PikaHubServer::BecomeSecondary() {
   rocksutil::Info(options_.info_log, "BecomeSecondary-6: reset binlog_writer");
   delete binlog_writer_;
   binlog_writer_ = nullptr;
+  /*
+   *  Keep the binlogs, they are resumed if no one else takes over
+   *  before this pika_hub becomes primary again, see RecoverBinlog
+   */
   rocksutil::Info(options_.info_log,
-      "BecomeSecondary-7: reset binlog_manager offset & binlog");
-  binlog_manager_->ResetOffsetAndBinlog();
+      "BecomeSecondary-7: keep binlog for resuming");
   primary_ = "NULL";
   rocksutil::Info(options_.info_log, "BecomeSecondary-8: reset primary");
   rocksutil::Info(options_.info_log, "BecomeSecondary done");
@@ -136,6 +136,21 @@ class PikaHubServer {
   void UpdateRcvOffset(int32_t server_id,
       int32_t number, int64_t offset);
   void GetBinlogWriterOffset(uint64_t* number, uint64_t* offset);
+  void GetGroupCommitStats(GroupCommitStats* stats);
+  void GetRollStats(RollStats* stats);
+  void GetSyncStats(SyncStats* stats);
+  /*
+   *  Purge binlogs every sender has gone past, and below limit,
+   *  return the status of BinlogManager::PurgeBinlogs
+   */
+  rocksutil::Status PurgeBinlogs(uint64_t limit, uint64_t* purged);
+  /*
+   *  Binlog files below it are not read by the sender of any configured
+   *  pika, even an unconnected one resuming from its send_number, unless
+   *  its send_number is out of retention, see RetentionLimit. Such a
+   *  pika is marked kNeedFullSync and no more counted
+   */
+  uint64_t SendWatermark();
   void Exit() {
     should_exit_ = true;
   }
@@ -202,6 +217,10 @@ class PikaHubServer {
       const RecoverOffsetMap::iterator& iter);
   void DecodeOffset(const std::string& value,
       uint64_t* rcv_number, uint64_t* rcv_offset);
+  bool RecoverBinlog();
+  void EncodeSendOffset(std::string* value, const std::string& holder);
+  static bool DecodeSendOffset(const std::string& value,
+      std::string* holder, std::map<int32_t, uint64_t>* send_numbers);
   PikaServers pika_servers_;
   slash::Status BecomePrimary();
   void BecomeSecondary();
@@ -57,8 +57,8 @@ bool PikaHubTrysync::Send(pink::PinkCli* cli,
   pink::RedisCmdArgsType argv;
   std::string wbuf_str;
   uint64_t number =
-    iter->second.rcv_number >= kMaxRecvRollbackNums ?
-      iter->second.rcv_number - kMaxRecvRollbackNums : 0;
+    iter->second.rcv_number >= recv_rollback_nums_ ?
+      iter->second.rcv_number - recv_rollback_nums_ : 0;
 
   argv.clear();
   argv.push_back("internaltrysync");
@@ -90,8 +90,8 @@ bool PikaHubTrysync::Recv(pink::PinkCli* cli,
   slash::Status s;
   std::string reply;
   uint64_t number =
-    iter->second.rcv_number >= kMaxRecvRollbackNums ?
-      iter->second.rcv_number - kMaxRecvRollbackNums : 0;
+    iter->second.rcv_number >= recv_rollback_nums_ ?
+      iter->second.rcv_number - recv_rollback_nums_ : 0;
 
   pink::RedisCmdArgsType argv;
   s = cli->Recv(&argv);
@@ -116,10 +116,10 @@ bool PikaHubTrysync::Recv(pink::PinkCli* cli,
   }
   iter->second.sync_status = kConnected;
   if (iter->second.sender == nullptr) {
-    uint64_t number = iter->second.send_number > 0 ?
-            iter->second.send_number - 1 : 0;
-    BinlogReader* reader = manager_->AddReader(number,
-        0);
+    // resume right after the last record sent to the pika
+    uint64_t number = iter->second.send_number;
+    uint64_t offset = iter->second.send_offset;
+    BinlogReader* reader = manager_->AddReader(number, offset);
     if (reader) {
       iter->second.sender = new BinlogSender(iter->first,
           iter->second.ip, iter->second.port, info_log_, reader,
@@ -127,11 +127,16 @@ bool PikaHubTrysync::Recv(pink::PinkCli* cli,
       static_cast<BinlogSender*>(iter->second.sender)->StartThread();
       Info(info_log_, "Start BinlogSender[%d] success for %s:%d(%llu %llu)",
           iter->first, iter->second.ip.c_str(), iter->second.port,
-          number, 0);
+          number, offset);
     } else {
       Error(info_log_, "Start BinlogSender[%d] Failed for %s:%d(%llu %llu)",
           iter->first, iter->second.ip.c_str(), iter->second.port,
-          number, 0);
+          number, offset);
+      if (manager_->BinlogPurged(number, offset)) {
+        Error(info_log_, "BinlogSender[%d] binlog %llu is purged, the "
+            "pika needs a full sync", iter->first, number);
+        iter->second.sync_status = kNeedFullSync;
+      }
     }
   }
   if (iter->second.heartbeat == nullptr) {
@@ -151,8 +156,8 @@ void PikaHubTrysync::Trysync(const PikaServers::
   cli->set_connect_timeout(1500);
   std::string master_ip;
   uint64_t number =
-    iter->second.rcv_number >= kMaxRecvRollbackNums ?
-      iter->second.rcv_number - kMaxRecvRollbackNums : 0;
+    iter->second.rcv_number >= recv_rollback_nums_ ?
+      iter->second.rcv_number - recv_rollback_nums_ : 0;
   if ((cli->Connect(iter->second.ip, iter->second.port)).ok()) {
     cli->set_send_timeout(3000);
     cli->set_recv_timeout(3000);
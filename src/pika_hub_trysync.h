@@ -29,14 +29,16 @@ class PikaHubTrysync : public pink::Thread {
     PikaServers* pika_servers,
     rocksutil::port::Mutex* pika_mutex,
     RecoverOffsetMap* recover_offset,
-    BinlogManager* manager)
+    BinlogManager* manager,
+    uint64_t recv_rollback_nums)
   : info_log_(info_log),
     local_ip_(local_ip),
     local_port_(local_port),
     pika_servers_(pika_servers),
     pika_mutex_(pika_mutex),
     recover_offset_(recover_offset),
-    manager_(manager) {}
+    manager_(manager),
+    recv_rollback_nums_(recv_rollback_nums) {}
 
   virtual ~PikaHubTrysync() {
     set_should_stop();
@@ -69,6 +71,8 @@ class PikaHubTrysync : public pink::Thread {
   rocksutil::port::Mutex* pika_mutex_;
   RecoverOffsetMap* recover_offset_;
   BinlogManager* manager_;
+  // how many binlog files pikas roll back to send from
+  uint64_t recv_rollback_nums_;
 
   void Trysync(const PikaServers::iterator& iter);
   bool Send(pink::PinkCli* cli,
@@ -0,0 +1,365 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+/*
+ *  Benchmark of decoding binlog records the way the senders use them:
+ *  decode a record, then filter its entries, skip the own server_id,
+ *  compare exec_time with the conflict metadata and take the largest
+ *  filenum of every server_id for recover_offset.
+ *
+ *  Records of --entries entries are encoded once in --format, every
+ *  decoder then decodes & filters all of them --repeats times:
+ *
+ *    views    DecodeBinlogEntries, one BinlogFieldsView per entry
+ *    columns  DecodeBinlogColumns, the fields packed in arrays
+ *
+ *  Usage: decode_bench --bench=views,columns --format=v2
+ *    --records=10000 --entries=32 --key_size=24 --value_size=64
+ *    --sources=3 --mixed_ratio=0.05 --repeats=20
+ *
+ *  An entry comes from the source of its record, or from another one
+ *  with --mixed_ratio, as a group of the writer mixes sources rarely.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <algorithm>
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_binlog_format.h"
+#include "src/pika_hub_binlog_decoder.h"
+#include "rocksutil/coding.h"
+
+struct BenchOptions {
+  std::string bench = "views,columns";
+  bool v2 = true;
+  uint64_t records = 10000;
+  int entries = 32;
+  size_t key_size = 24;
+  size_t value_size = 64;
+  int32_t sources = 3;
+  double mixed_ratio = 0.05;
+  int repeats = 20;
+};
+
+// the sender's own server_id, its entries are not sent back
+static const int32_t kOwnServerId = 0;
+
+/*
+ *  What the filters found, the same for every decoder, also keeps the
+ *  compiler from dropping the work
+ */
+struct FilterResult {
+  uint64_t sent = 0;
+  uint64_t conflicted = 0;
+  uint64_t bytes = 0;
+  int64_t filenums = 0;
+
+  bool operator==(const FilterResult& other) const {
+    return sent == other.sent && conflicted == other.conflicted &&
+      bytes == other.bytes && filenums == other.filenums;
+  }
+};
+
+/*
+ *  The records as BinlogUncompress leaves them, encoded as
+ *  BinlogWriter does, see pika_hub_binlog_format.h
+ */
+static void EncodeEntry(std::string* rep, bool v2, int32_t base_server_id,
+    int32_t base_exec_time, uint8_t op, const std::string& key,
+    const std::string& value, int32_t server_id, int32_t exec_time,
+    int32_t filenum) {
+  if (!v2) {
+    rep->push_back(static_cast<char>(op));
+    rocksutil::PutFixed32(rep, server_id);
+    rocksutil::PutFixed32(rep, exec_time);
+    rocksutil::PutFixed32(rep, filenum);
+    rocksutil::PutFixed32(rep, key.size());
+    rep->append(key);
+    rocksutil::PutFixed32(rep, value.size());
+    rep->append(value);
+    return;
+  }
+  rep->push_back(static_cast<char>(op));
+  rocksutil::PutVarint32(rep, ZigZagEncode32(server_id - base_server_id));
+  rocksutil::PutVarint32(rep, ZigZagEncode32(exec_time - base_exec_time));
+  rocksutil::PutVarint32(rep, ZigZagEncode32(filenum));
+  rocksutil::PutVarint32(rep, key.size());
+  rep->append(key);
+  rocksutil::PutVarint32(rep, value.size());
+  rep->append(value);
+}
+
+/*
+ *  The conflict metadata is a watermark here, the entries written
+ *  before it are stale
+ */
+static const int32_t kStaleExecTime = 1000000;
+static const int32_t kFreshExecTime = 1000000000;
+
+static std::vector<std::string> MakeRecords(const BenchOptions& options,
+    int32_t* watermark) {
+  std::mt19937_64 rand(0);
+  std::uniform_real_distribution<double> mixed(0, 1);
+  std::vector<std::string> records(options.records);
+  int32_t exec_time = kFreshExecTime;
+  int32_t filenum = 1;
+  for (uint64_t r = 0; r < options.records; r++) {
+    std::string* rep = &records[r];
+    int32_t source = static_cast<int32_t>(r % options.sources);
+    if (options.v2) {
+      rocksutil::PutVarint32(rep, ZigZagEncode32(source));
+      rocksutil::PutVarint32(rep, ZigZagEncode32(exec_time));
+    }
+    int32_t base_exec_time = exec_time;
+    for (int e = 0; e < options.entries; e++) {
+      int32_t server_id = source;
+      if (options.sources > 1 && mixed(rand) < options.mixed_ratio) {
+        server_id = (source + 1 + rand() % (options.sources - 1)) %
+          options.sources;
+      }
+      std::string key = "key:" + std::to_string(rand() % 1000000);
+      key.resize(options.key_size, 'x');
+      std::string value(options.value_size, 'v');
+      uint8_t op = rand() % 8 == 0 ? kDelOPCode : kSetOPCode;
+      // a quarter of the entries have a newer write in the binlog
+      int32_t lag = rand() % 4 == 0 ? kFreshExecTime - kStaleExecTime : 0;
+      EncodeEntry(rep, options.v2, source, base_exec_time, op, key,
+          op == kDelOPCode ? std::string() : value, server_id,
+          exec_time++ - lag, filenum);
+      if (rand() % 1024 == 0) {
+        filenum++;
+      }
+    }
+  }
+  *watermark = kFreshExecTime;
+  return records;
+}
+
+static void AddFilenum(std::vector<std::pair<int32_t, int32_t> >* filenums,
+    int32_t server_id, int32_t filenum) {
+  for (auto& f : *filenums) {
+    if (f.first == server_id) {
+      f.second = std::max(f.second, filenum);
+      return;
+    }
+  }
+  filenums->push_back(std::make_pair(server_id, filenum));
+}
+
+static void FilterViews(const std::vector<BinlogFieldsView>& fields,
+    int32_t watermark, FilterResult* result) {
+  std::vector<std::pair<int32_t, int32_t> > filenums;
+  for (auto& field : fields) {
+    AddFilenum(&filenums, field.server_id, field.filenum);
+    if (field.exec_time < watermark) {
+      result->conflicted++;
+      continue;
+    }
+    if (field.server_id != kOwnServerId) {
+      result->sent++;
+      result->bytes += field.key.size() + field.value.size();
+    }
+  }
+  for (auto& f : filenums) {
+    result->filenums += f.second;
+  }
+}
+
+static void FilterColumns(const BinlogColumns& columns, int32_t watermark,
+    FilterResult* result) {
+  const size_t n = columns.size();
+  const int32_t* server_ids = columns.server_ids.data();
+  const int32_t* exec_times = columns.exec_times.data();
+  const int32_t* nums = columns.filenums.data();
+  const uint32_t* key_sizes = columns.key_sizes.data();
+  const uint32_t* value_sizes = columns.value_sizes.data();
+
+  std::vector<std::pair<int32_t, int32_t> > filenums;
+  int32_t diff = 0;
+  for (size_t i = 1; i < n; i++) {
+    diff |= server_ids[i] ^ server_ids[0];
+  }
+  if (n > 0 && diff == 0) {
+    int32_t max_filenum = nums[0];
+    for (size_t i = 1; i < n; i++) {
+      max_filenum = std::max(max_filenum, nums[i]);
+    }
+    filenums.push_back(std::make_pair(server_ids[0], max_filenum));
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      AddFilenum(&filenums, server_ids[i], nums[i]);
+    }
+  }
+
+  // branch free, a stale entry at random costs no mispredict
+  uint64_t sent = 0;
+  uint64_t conflicted = 0;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t stale = exec_times[i] < watermark;
+    uint64_t send = !stale & (server_ids[i] != kOwnServerId);
+    conflicted += stale;
+    sent += send;
+    bytes += send * (static_cast<uint64_t>(key_sizes[i]) + value_sizes[i]);
+  }
+  result->sent += sent;
+  result->conflicted += conflicted;
+  result->bytes += bytes;
+  for (auto& f : filenums) {
+    result->filenums += f.second;
+  }
+}
+
+static uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchResult {
+  uint64_t decode_ns = 0;
+  uint64_t filter_ns = 0;
+  FilterResult filter;
+};
+
+static bool RunBench(const std::string& name, const BenchOptions& options,
+    const std::vector<std::string>& records, int32_t watermark,
+    BenchResult* result) {
+  std::vector<BinlogFieldsView> fields;
+  BinlogColumns columns;
+  bool views = name == "views";
+  if (!views && name != "columns") {
+    fprintf(stderr, "unknown bench %s\n", name.c_str());
+    return false;
+  }
+  /*
+   *  Decode alone first, then decode & filter, so the clock is not read
+   *  per record, the filter takes the difference
+   */
+  for (int r = 0; r < options.repeats; r++) {
+    uint64_t start = NowNanos();
+    for (auto& record : records) {
+      bool ok = views ?
+        DecodeBinlogEntries(record, options.v2, &fields) :
+        DecodeBinlogColumns(record, options.v2, &columns);
+      if (!ok) {
+        fprintf(stderr, "%s: bad record\n", name.c_str());
+        return false;
+      }
+    }
+    uint64_t decoded = NowNanos();
+
+    FilterResult filter;
+    for (auto& record : records) {
+      if (views) {
+        DecodeBinlogEntries(record, options.v2, &fields);
+        FilterViews(fields, watermark, &filter);
+      } else {
+        DecodeBinlogColumns(record, options.v2, &columns);
+        FilterColumns(columns, watermark, &filter);
+      }
+    }
+    uint64_t filtered = NowNanos();
+    uint64_t decode_ns = decoded - start;
+    uint64_t total_ns = filtered - decoded;
+    result->decode_ns += decode_ns;
+    result->filter_ns += total_ns > decode_ns ? total_ns - decode_ns : 0;
+    result->filter = filter;
+  }
+  return true;
+}
+
+static bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  std::string value;
+  for (int i = 1; i < argc; i++) {
+    if (ParseFlag(argv[i], "bench", &value)) {
+      options.bench = value;
+    } else if (ParseFlag(argv[i], "format", &value)) {
+      if (value != "v1" && value != "v2") {
+        fprintf(stderr, "unknown format %s\n", value.c_str());
+        return 1;
+      }
+      options.v2 = value == "v2";
+    } else if (ParseFlag(argv[i], "records", &value)) {
+      options.records = std::max<uint64_t>(1,
+          std::strtoull(value.c_str(), nullptr, 10));
+    } else if (ParseFlag(argv[i], "entries", &value)) {
+      options.entries = std::max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "key_size", &value)) {
+      options.key_size = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(argv[i], "value_size", &value)) {
+      options.value_size = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(argv[i], "sources", &value)) {
+      options.sources = std::max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "mixed_ratio", &value)) {
+      options.mixed_ratio = atof(value.c_str());
+    } else if (ParseFlag(argv[i], "repeats", &value)) {
+      options.repeats = std::max(1, atoi(value.c_str()));
+    } else {
+      fprintf(stderr, "unknown flag %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  int32_t watermark = 0;
+  std::vector<std::string> records = MakeRecords(options, &watermark);
+  printf("format %s, records %lu, entries %d, key_size %zu, "
+      "value_size %zu, sources %d, mixed_ratio %.2f, repeats %d\n",
+      options.v2 ? "v2" : "v1", options.records, options.entries,
+      options.key_size, options.value_size, options.sources,
+      options.mixed_ratio, options.repeats);
+  printf("%-10s %12s %12s %12s %14s\n", "bench", "decode(ns)",
+      "filter(ns)", "total(ns)", "entries/s");
+
+  double entries = static_cast<double>(options.records) * options.entries *
+    options.repeats;
+  bool first = true;
+  FilterResult expected;
+  size_t pos = 0;
+  while (pos <= options.bench.size()) {
+    size_t end = options.bench.find(',', pos);
+    if (end == std::string::npos) {
+      end = options.bench.size();
+    }
+    if (end > pos) {
+      std::string name = options.bench.substr(pos, end - pos);
+      BenchResult result;
+      if (!RunBench(name, options, records, watermark, &result)) {
+        return 1;
+      }
+      uint64_t total_ns = result.decode_ns + result.filter_ns;
+      printf("%-10s %12.2f %12.2f %12.2f %14.0f\n", name.c_str(),
+          result.decode_ns / entries, result.filter_ns / entries,
+          total_ns / entries, entries / (total_ns / 1e9));
+      if (first) {
+        expected = result.filter;
+        first = false;
+      } else if (!(result.filter == expected)) {
+        fprintf(stderr, "%s: filter result differs\n", name.c_str());
+        return 1;
+      }
+    }
+    pos = end + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+//  Copyright (c) 2017-present The pika_hub Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+/*
+ *  Stress of the conflict table with conflict_fingerprint: inserts
+ *  --keys distinct keys and counts the keys that actually share an
+ *  entry with another one, against ConflictTable::ExpectedCollisions.
+ *
+ *  Keys sharing a 64-bit fingerprint are too rare to be seen with any
+ *  number of keys that fits in memory, so the same hashes are also cut
+ *  to the top --bits bits, where the colliding pairs are counted and
+ *  compared with the birthday bound n * (n - 1) / 2^(bits + 1). Counts
+ *  far above it mean HashKey does not spread the keys evenly.
+ *
+ *  Usage: fingerprint_stress --keys=10000000 --key_size=32 --seed=0
+ *    --bits=32,40,48
+ *
+ *  Keys are "key:<seed>:<i>" padded to key_size, a new seed gives a new
+ *  set of keys.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "src/pika_hub_common.h"
+#include "src/pika_hub_conflict_table.h"
+
+struct StressOptions {
+  uint64_t keys = 10000000;
+  size_t key_size = 32;
+  uint64_t seed = 0;
+  std::string bits = "32,40,48";
+};
+
+static std::string MakeKey(uint64_t seed, uint64_t i, size_t key_size) {
+  std::string key = "key:" + std::to_string(seed) + ":" + std::to_string(i);
+  if (key.size() < key_size) {
+    key.append(key_size - key.size(), 'x');
+  }
+  return key;
+}
+
+// pairs of equal values in the top bits of the sorted hashes
+static uint64_t CountPairs(const std::vector<uint64_t>& hashes, int bits) {
+  uint64_t pairs = 0;
+  uint64_t run = 1;
+  for (size_t i = 1; i <= hashes.size(); i++) {
+    if (i < hashes.size() &&
+        hashes[i] >> (64 - bits) == hashes[i - 1] >> (64 - bits)) {
+      run++;
+      continue;
+    }
+    pairs += run * (run - 1) / 2;
+    run = 1;
+  }
+  return pairs;
+}
+
+static bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  StressOptions options;
+  std::string value;
+  for (int i = 1; i < argc; i++) {
+    if (ParseFlag(argv[i], "keys", &value)) {
+      options.keys = std::max<uint64_t>(1,
+          std::strtoull(value.c_str(), nullptr, 10));
+    } else if (ParseFlag(argv[i], "key_size", &value)) {
+      options.key_size = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(argv[i], "seed", &value)) {
+      options.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (ParseFlag(argv[i], "bits", &value)) {
+      options.bits = value;
+    } else {
+      fprintf(stderr, "unknown flag %s\n", argv[i]);
+      return 1;
+    }
+  }
+  printf("keys %lu, key_size %zu, seed %lu\n", options.keys,
+      options.key_size, options.seed);
+
+  // no eviction and no single writer filter, every key goes to a slot
+  BinlogOptions binlog_options;
+  binlog_options.conflict_fingerprint = true;
+  binlog_options.conflict_max_memory = 0;
+  binlog_options.conflict_single_writer_bits = 0;
+  ConflictTable table(binlog_options);
+
+  std::vector<uint64_t> hashes;
+  hashes.reserve(options.keys);
+  uint64_t dropped = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < options.keys; i++) {
+    std::string key = MakeKey(options.seed, i, options.key_size);
+    hashes.push_back(ConflictTable::HashKey(key));
+    // newer than every key before, a colliding key takes the entry over
+    if (!table.Update(key, 1, static_cast<int32_t>(i), 0)) {
+      dropped++;
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  uint64_t size = table.Size();
+  printf("inserted in %.2f s, %lu entries, %lu dropped\n", seconds,
+      size, dropped);
+  printf("%-8s %14s %14s\n", "bits", "collisions", "expected");
+  // a shared entry is one key less in the table
+  printf("%-8s %14lu %14.6f\n", "table", options.keys - size,
+      table.ExpectedCollisions());
+
+  std::sort(hashes.begin(), hashes.end());
+  double n = static_cast<double>(options.keys);
+  size_t pos = 0;
+  while (pos <= options.bits.size()) {
+    size_t end = options.bits.find(',', pos);
+    if (end == std::string::npos) {
+      end = options.bits.size();
+    }
+    int bits = atoi(options.bits.substr(pos, end - pos).c_str());
+    if (bits > 0 && bits <= 64) {
+      printf("%-8d %14lu %14.6f\n", bits, CountPairs(hashes, bits),
+          n * (n - 1) / (2 * std::pow(2.0, bits)));
+    }
+    pos = end + 1;
+  }
+  return 0;
+}